@@ -1,53 +1,110 @@
 #pragma once
 
 #include "common.hpp"
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <bitset>
 #include <byteswap.h>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <limits>
+#include <optional>
 #include <random>
 #include <span>
-#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <sys/types.h>
 #include <unistd.h>
+#include <utility>
 #include <vector>
+#ifdef CHIP8_PROFILE
+#include "chip8_profiler.hpp"
+#endif
 
-class Chip8 {
-  private:
+// How far FX55/FX65 move I past the registers they copy.
+enum class Chip8IndexIncrement : uint8_t { NONE, X, X_PLUS_1 };
+
+// Behaviour that differs between CHIP-8 interpreters. Each quirk picks a
+// handler when an instruction is decoded, so execution never tests one.
+struct Chip8Quirks {
+    // 8XY6/8XYE shift VY into VX instead of shifting VX in place
+    bool shiftUsesVY = false;
+    Chip8IndexIncrement indexIncrement = Chip8IndexIncrement::NONE;
+    // BNNN is BXNN, jumping to XNN + VX instead of NNN + V0
+    bool jumpUsesVX = false;
+    // sprites stop at the screen edges instead of wrapping round
+    bool clipSprites = false;
+    // 8XY1/8XY2/8XY3 clear VF
+    bool logicResetsVF = false;
+    // DXYN ends the frame's instructions, as the VIP waited for vblank
+    bool displayWait = false;
+    // SUPER-CHIP instructions: 128x64 mode, scrolling, 16x16 sprites, the
+    // big font, RPL flags and exit
+    bool superChip = false;
+    // XO-CHIP's additions: 64 KB of memory with F000 NNNN to reach it, two
+    // display planes, 00DN, 5XY2/5XY3 and the audio pattern buffer. XO-CHIP
+    // programs also expect superChip.
+    bool xoChip = false;
+
+    bool operator==(const Chip8Quirks &) const = default;
+};
+
+// Cacheline-aligned so instances packed into a Chip8Arena never share a
+// line.
+class alignas(64) Chip8 {
+  public:
     struct Chip8Hardware {
         static constexpr int STACK_SIZE = 64;
-        static constexpr int MEMORY_SIZE = 4096;
+        // XO-CHIP's; every other mode only sees the first
+        // CLASSIC_MEMORY_SIZE bytes
+        static constexpr int MEMORY_SIZE = 0x10000;
+        static constexpr int CLASSIC_MEMORY_SIZE = 0x1000;
         static constexpr int REGISTER_COUNT = 16;
         static constexpr int KEY_COUNT = 16;
         static constexpr int FONT_SET_START = 0x0;
         static constexpr int FONT_SET_SIZE = 0x80;
+        static constexpr int BIG_FONT_SET_START = FONT_SET_START + FONT_SET_SIZE;
         static constexpr int PROGRAM_START = 0x200;
         static constexpr int DISPLAY_START = 0xF00;
         // in bytes
         static constexpr int DISPLAY_SIZE = 0x100;
+        // SUPER-CHIP's 128x64 mode, which cannot fit in MEMORY
+        static constexpr int HIRES_DISPLAY_SIZE = 128 * 64 / 8;
+        // XO-CHIP's 1-bit sample loop, played while the sound timer runs
+        static constexpr int AUDIO_PATTERN_SIZE = 16;
+        static constexpr int DEFAULT_PITCH = 64;
 
+        // serializeState() writes these one by one, so list new ones there
         std::array<uint8_t, MEMORY_SIZE> MEMORY = {};
         uint8_t REGISTERS[REGISTER_COUNT] = {};
         uint8_t STACK[STACK_SIZE] = {};
         uint16_t KEY_STATE = 0;
         uint16_t PC = PROGRAM_START;
         uint16_t SP = 0;
-        // only 12 bits
+        // 12 bits, or 16 under XO-CHIP
         uint16_t I = 0;
         uint8_t DELAY_TIMER = 0;
         uint8_t SOUND_TIMER = 0;
-
-        void reset() {
-            KEY_STATE = 0;
-            PC = PROGRAM_START;
-            SP = 0;
-            I = 0;
-            DELAY_TIMER = 0;
-            SOUND_TIMER = 0;
-        }
+        // SUPER-CHIP only
+        bool HIRES = false;
+        uint8_t RPL_FLAGS[REGISTER_COUNT] = {};
+        // also XO-CHIP's first plane at either resolution, since its
+        // programs use all of MEMORY
+        std::array<uint8_t, HIRES_DISPLAY_SIZE> HIRES_DISPLAY = {};
+        // the rest is XO-CHIP only
+        std::array<uint8_t, HIRES_DISPLAY_SIZE> SECOND_PLANE = {};
+        // one bit per plane that draws, clears and scrolls act on
+        uint8_t PLANES = 1;
+        uint8_t PITCH = DEFAULT_PITCH;
+        // a 500 Hz square wave until F002 loads another
+        std::array<uint8_t, AUDIO_PATTERN_SIZE> AUDIO_PATTERN = {
+            0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+            0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0};
     };
 
     // probably not the best way to do this
@@ -72,8 +129,32 @@ class Chip8 {
             0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
             0xF0, 0x80, 0xF0, 0x80, 0x80  // F
         };
+        // SUPER-CHIP's 8x10 digits for FX30
+        static constexpr int BIG_SPRITE_MEMORY_SIZE = 100;
+        static constexpr int BIG_SPRITE_HEIGHT = 10;
+        static constexpr std::array<uint8_t, BIG_SPRITE_MEMORY_SIZE>
+            bigSprites = {
+                0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+                0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+                0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+                0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+                0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+                0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+                0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+                0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+                0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+            };
     };
 
+    static constexpr int CHIP8_DISPLAY_WIDTH = 64;
+    static constexpr int CHIP8_DISPLAY_HEIGHT = 32;
+    static constexpr int SCHIP_DISPLAY_WIDTH = 128;
+    static constexpr int SCHIP_DISPLAY_HEIGHT = 64;
+    // XO-CHIP's; every other mode draws to the first only
+    static constexpr int DISPLAY_PLANES = 2;
+
+  private:
     const uint8_t *spriteAddress(int spriteIndex) {
         if (spriteIndex < 0 || spriteIndex > 0xF) {
             throw std::runtime_error("Sprite index out of bounds\n");
@@ -82,28 +163,90 @@ class Chip8 {
                                       Chip8Sprites::SPRITE_HEIGHT];
     }
 
-    static constexpr int CHIP8_DISPLAY_WIDTH = 64;
-    static constexpr int CHIP8_DISPLAY_HEIGHT = 32;
+    static constexpr int DISPLAY_ROW_BYTES = CHIP8_DISPLAY_WIDTH / 8;
+    // N is a nibble
+    static constexpr int MAX_SPRITE_HEIGHT = 15;
+    // SUPER-CHIP's DXY0
+    static constexpr int BIG_SPRITE_SIZE = 16;
+
+    // A display row is big-endian words in memory, so the leftmost pixel is
+    // the top bit and the byte layout seen by getDisplayBuffer() is plain
+    // row-major. Hi-res rows are 128 bits, handled as one integer so that
+    // blits and scrolls stay whole-row shifts.
+    template <int Width>
+    using DisplayRow =
+        std::conditional_t<Width == 64, uint64_t, unsigned __int128>;
+
+    static uint64_t loadWord(const uint8_t *bytes) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        if constexpr (std::endian::native == std::endian::little) {
+            word = std::byteswap(word);
+        }
+        return word;
+    }
+    static void storeWord(uint8_t *bytes, uint64_t word) {
+        if constexpr (std::endian::native == std::endian::little) {
+            word = std::byteswap(word);
+        }
+        memcpy(bytes, &word, sizeof(word));
+    }
+    template <int Width>
+    static DisplayRow<Width> loadDisplayRow(std::span<const uint8_t> display,
+                                            int row) {
+        const uint8_t *bytes = &display[row * (Width / BITS_PER_BYTE)];
+        if constexpr (Width == 64) {
+            return loadWord(bytes);
+        } else {
+            return DisplayRow<Width>(loadWord(bytes)) << 64 |
+                   loadWord(bytes + sizeof(uint64_t));
+        }
+    }
+    template <int Width>
+    static void storeDisplayRow(std::span<uint8_t> display, int row,
+                                DisplayRow<Width> bits) {
+        uint8_t *bytes = &display[row * (Width / BITS_PER_BYTE)];
+        if constexpr (Width == 64) {
+            storeWord(bytes, bits);
+        } else {
+            storeWord(bytes, bits >> 64);
+            storeWord(bytes + sizeof(uint64_t), static_cast<uint64_t>(bits));
+        }
+    }
 
   public:
     // DO NOT CHANGE, TIMERS RELY ON THIS
     static constexpr int TARGET_FPS = 60;
-    static constexpr int FRAME_TIME_MS = 1000 / TARGET_FPS;
 
-    Chip8()
-        : hardware(), gen(std::random_device{}()),
+    Chip8() : Chip8(std::random_device{}()) {}
+    // a fixed seed makes CXKK, and so the whole run, reproducible
+    explicit Chip8(uint32_t seed)
+        : hardware(), gen(seed),
           dist(std::numeric_limits<uint8_t>::min(),
                std::numeric_limits<uint8_t>::max()) {
         assert(CHIP8_DISPLAY_HEIGHT * CHIP8_DISPLAY_WIDTH ==
                Chip8Hardware::DISPLAY_SIZE * BITS_PER_BYTE);
-        // TODO improve me
-        memcpy(hardware.MEMORY.data(), Chip8Sprites::sprites.data(),
-               Chip8Sprites::SPRITE_MEMORY_SIZE);
+        loadFonts();
     }
 
-    void reset() {
-        hardware.reset();
-        clearDisplay();
+    // Back to power-on: memory, fonts and the last loaded program, every
+    // register, the stack and the timers. Quirks, debug points and the RNG
+    // stream carry over unless `seed` restarts it.
+    void reset(std::optional<uint32_t> seed = std::nullopt);
+    // Copies make complete machines, decode cache included, so the cheap
+    // way to get many fresh instances is one bulk copy of a golden one
+    // that was loaded, configured and precompiled once. Unlike the
+    // std::random_device constructor, no entropy source is touched.
+    void cloneFrom(const Chip8 &golden,
+                   std::optional<uint32_t> seed = std::nullopt) {
+        *this = golden;
+        if (seed) {
+            reseed(*seed);
+        }
+    }
+    void reseed(uint32_t seed) {
+        gen.seed(seed);
+        dist.reset();
     }
 
     enum class Status {
@@ -112,49 +255,528 @@ class Chip8 {
         UNRECOGNIZED_KEY,
         INVALID_INSTRUCTION,
         ERROR,
+        INVALID_STATE,
+        // internal to a display-wait DXYN; runCycles() and step() turn it
+        // into OK after ending the run
+        DISPLAY_WAIT,
+        // SUPER-CHIP's 00FD
+        PROGRAM_EXITED,
+        // a breakpoint, watchpoint or condition stopped the run before the
+        // instruction at PC; getDebugEvent() says which
+        BREAKPOINT,
+        // faults; like INVALID_INSTRUCTION, PC stays on the instruction
+        // 2NNN with STACK_SIZE bytes of return addresses already pushed
+        STACK_OVERFLOW,
+        // 00EE with nothing to return to
+        STACK_UNDERFLOW,
+        // a sprite, FX33, FX55 or FX65 reaching past the end of MEMORY
+        MEMORY_OUT_OF_BOUNDS,
     };
 
-    Status loadProgram(std::vector<uint8_t> program);
+    using IndexIncrement = Chip8IndexIncrement;
+    using Quirks = Chip8Quirks;
+    // what this core always did
+    static constexpr Quirks MODERN_QUIRKS = {};
+    static constexpr Quirks COSMAC_VIP_QUIRKS = {
+        .shiftUsesVY = true,
+        .indexIncrement = IndexIncrement::X_PLUS_1,
+        .clipSprites = true,
+        .logicResetsVF = true,
+        .displayWait = true,
+    };
+    static constexpr Quirks CHIP48_QUIRKS = {
+        .indexIncrement = IndexIncrement::X,
+        .jumpUsesVX = true,
+        .clipSprites = true,
+    };
+    static constexpr Quirks SCHIP_QUIRKS = {
+        .jumpUsesVX = true,
+        .clipSprites = true,
+        .superChip = true,
+    };
+    // as Octo runs it
+    static constexpr Quirks XO_CHIP_QUIRKS = {
+        .indexIncrement = IndexIncrement::X_PLUS_1,
+        .superChip = true,
+        .xoChip = true,
+    };
+    // "modern", "vip", "chip48", "schip" or "xochip"
+    static std::optional<Quirks> findQuirks(std::string_view name);
+    // Whether the core runs `instruction` rather than stopping with
+    // INVALID_INSTRUCTION; the disassembler's analysis asks the same. Only
+    // the superChip and xoChip quirks add opcodes. 5XYN and 9XYN run as
+    // 5XY0 and 9XY0 whatever N is, bar XO-CHIP's 5XY2 and 5XY3.
+    static bool isValidInstruction(uint16_t instruction, const Quirks &quirks);
+
+    // Changing quirks drops the decode cache. Set them before loading a
+    // program: xoChip decides how much of MEMORY there is to load into and
+    // where the display lives.
+    void setQuirks(const Quirks &newQuirks) {
+        quirks = newQuirks;
+        addressMask = (newQuirks.xoChip ? Chip8Hardware::MEMORY_SIZE
+                                        : Chip8Hardware::CLASSIC_MEMORY_SIZE) -
+                      1;
+        invalidateAllDecoded();
+    }
+    const Quirks &getQuirks() const { return quirks; }
+
+    // Copies `program` to PROGRAM_START and keeps the view for reset(),
+    // so the image must outlive the emulator or the next load. Images from
+    // a Chip8RomCache stay mapped for the cache's lifetime.
+    Status loadProgram(std::span<const uint8_t> program);
+    // Decodes and compiles every block statically reachable from PC, so
+    // the first frames do not pay for discovering them. Call it after
+    // setQuirks(), which drops the decode cache.
+    void precompile();
+    // the memory the program can address
+    std::span<const uint8_t> getMemory() const {
+        return std::span(hardware.MEMORY).first(addressMask + 1);
+    }
 
-    const std::span<const uint8_t, Chip8Hardware::DISPLAY_SIZE>
-    getDisplayBuffer() const;
+    // Row-major, one bit per pixel, getDisplayWidth() / 8 bytes per row.
+    // 256 bytes normally, 1024 in SUPER-CHIP's hi-res mode. Plane 1 is
+    // XO-CHIP's second plane; a pixel's colour is its two plane bits.
+    std::span<const uint8_t> getDisplayBuffer(int plane = 0) const;
 
     void handleKeyUp(uint8_t chip8code);
     void handleKeyDown(uint8_t chip8code);
-    static constexpr const int getDisplayWidth() { return CHIP8_DISPLAY_WIDTH; }
-    static constexpr const int getDisplayHeight() {
-        return CHIP8_DISPLAY_HEIGHT;
+    // replaces the whole keypad at once, one bit per key
+    void setKeyState(uint16_t keyState) { hardware.KEY_STATE = keyState; }
+    uint16_t getKeyState() const { return hardware.KEY_STATE; }
+    int getDisplayWidth() const {
+        return hardware.HIRES ? SCHIP_DISPLAY_WIDTH : CHIP8_DISPLAY_WIDTH;
+    }
+    int getDisplayHeight() const {
+        return hardware.HIRES ? SCHIP_DISPLAY_HEIGHT : CHIP8_DISPLAY_HEIGHT;
     }
+    // Display rows changed since the last call, bit 0 being the top row;
+    // in hi-res each bit covers two rows. Lets a renderer skip unchanged
+    // frames and re-expand only what moved.
+    uint32_t takeDirtyRows() { return std::exchange(dirtyRows, 0); }
 
     Status step();
+    // Runs up to `cycles` instructions through the block engine, stopping
+    // early on the first non-OK status or a display-wait draw. Otherwise
+    // architecturally identical to calling step() `cycles` times.
+    Status runCycles(int cycles);
+    // One 60 Hz frame: `instructionsPerFrame` instructions, then a timer
+    // tick. Timers still tick if the frame stops early on an error.
+    Status runFrame(int instructionsPerFrame);
     void decrementTimers();
-    std::string getState() {
-        std::stringstream out;
-        out << "PC: " << std::hex << hardware.PC << "\n";
-        out << "SP: " << std::hex << hardware.SP << "\n";
-        for (int i = 0; i < Chip8Hardware::REGISTER_COUNT; i++) {
-            out << "V[" << std::hex << i << "]=" << std::hex
-                << static_cast<int>(hardware.REGISTERS[i]) << " ";
-        }
-        out << "\nI: " << std::hex << hardware.I << "\n";
-        out << "DT: " << std::hex << static_cast<int>(hardware.DELAY_TIMER)
-            << "\n";
-        out << "ST: " << std::hex << static_cast<int>(hardware.SOUND_TIMER)
-            << "\n";
-        return out.str();
+    // A copy of the registers a debugger or a report wants to see.
+    struct CpuState {
+        uint16_t pc = 0;
+        uint16_t sp = 0;
+        uint16_t i = 0;
+        std::array<uint8_t, Chip8Hardware::REGISTER_COUNT> registers = {};
+        uint8_t delayTimer = 0;
+        uint8_t soundTimer = 0;
+        uint16_t keyState = 0;
+        bool hires = false;
+        // return addresses, outermost first
+        std::vector<uint16_t> callStack;
+
+        // the text dump the runners print
+        std::string toString() const;
+    };
+    CpuState getState() const;
+    // Debugging. Breakpoints and watchpoints are planted in the decode
+    // cache as stand-in handlers and conditions switch runCycles() to a
+    // checked loop, so none of them cost anything while unset.
+    enum class WatchKind : uint8_t { READ = 1, WRITE = 2, READ_WRITE = 3 };
+    enum class ConditionOperand : uint8_t {
+        REGISTER,
+        INDEX,
+        DELAY_TIMER,
+        SOUND_TIMER
+    };
+    enum class Comparison : uint8_t {
+        EQUAL,
+        NOT_EQUAL,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL
+    };
+    // stops when the comparison becomes true, not while it stays true
+    struct Condition {
+        ConditionOperand operand = ConditionOperand::REGISTER;
+        // for REGISTER
+        uint8_t x = 0;
+        Comparison comparison = Comparison::EQUAL;
+        uint16_t value = 0;
+    };
+    struct DebugEvent {
+        enum class Kind : uint8_t { BREAKPOINT, WATCHPOINT, CONDITION };
+        Kind kind = Kind::BREAKPOINT;
+        uint16_t pc = 0;
+        // the watched address touched, or the condition's index
+        uint16_t detail = 0;
+    };
+    static constexpr int MAX_CONDITIONS = 32;
+
+    void addBreakpoint(uint16_t address);
+    void removeBreakpoint(uint16_t address);
+    // instruction fetches are not reads; use a breakpoint for those
+    void addWatchpoint(uint16_t address, uint16_t length, WatchKind kind);
+    // false once MAX_CONDITIONS are set
+    bool addCondition(const Condition &condition);
+    void clearDebugPoints();
+    const DebugEvent &getDebugEvent() const { return debugEvent; }
+    // Lets the instruction at PC run once past the breakpoint or watchpoint
+    // that stopped it. Call before continuing.
+    void resume();
+    // Whole frames until PC reaches `address`, something else stops the
+    // run, or `frames` have passed.
+    Status runUntil(uint16_t address, int frames, int instructionsPerFrame);
+
+    // Instructions retired since construction. Save states leave it alone,
+    // so it is a clock for the host, not machine state.
+    uint64_t getCycles() const { return cycleCount; }
+    // The beep switching on or off, stamped with getCycles() at the moment
+    // it happened so a frontend can place it within the frame.
+    struct SoundEvent {
+        uint64_t cycle;
+        bool on;
+    };
+    static constexpr int MAX_SOUND_EVENTS = 16;
+    // Events since the last call, oldest first. The view is only good until
+    // the emulator runs again.
+    std::span<const SoundEvent> takeSoundEvents() {
+        return std::span(soundEvents).first(std::exchange(soundEventCount, 0));
     }
+
     bool shouldBeep() { return hardware.SOUND_TIMER > 0; }
+    // What XO-CHIP plays while the beep is on: the pattern's bits, MSB
+    // first and looped, at getAudioPatternRate() bits per second. Other
+    // modes never change either.
+    std::span<const uint8_t, Chip8Hardware::AUDIO_PATTERN_SIZE>
+    getAudioPattern() const {
+        return hardware.AUDIO_PATTERN;
+    }
+    double getAudioPatternRate() const {
+        return 4000.0 *
+               std::exp2((hardware.PITCH - Chip8Hardware::DEFAULT_PITCH) / 48.0);
+    }
+
+    // Edge coverage for fuzzing. Every block entered, or every instruction
+    // in step(), sets the bit for the (previous, current) PC pair in a
+    // caller-owned bitmap, AFL style. nullptr, the default, turns it off.
+    static constexpr int COVERAGE_BITS = 1 << 16;
+    using CoverageMap = std::array<uint8_t, COVERAGE_BITS / BITS_PER_BYTE>;
+    void setCoverageMap(CoverageMap *map) {
+        coverage = map;
+        previousLocation = 0;
+    }
+
+    // Everything that decides how execution continues, trivially copyable
+    // so saving or restoring one is a plain struct copy. serializeState()
+    // writes the fields one by one, so new ones go there too.
+    struct Snapshot {
+        Chip8Hardware hardware;
+        std::mt19937 gen;
+        bool waitingForKeyUp;
+        uint8_t keyPressed;
+    };
+    void saveState(Snapshot &snapshot) const;
+    void loadState(const Snapshot &snapshot);
+
+    // Byte form of a Snapshot behind a magic/version header, for files.
+    // The payload is the in-memory layout with the padding zeroed, so files
+    // only load into builds with the same ABI; the size check rejects the
+    // rest.
+    static constexpr uint32_t STATE_VERSION = 3;
+    static constexpr std::size_t SERIALIZED_STATE_SIZE =
+        3 * sizeof(uint32_t) + sizeof(Snapshot);
+    // Writes into `buffer` without allocating and returns the bytes used,
+    // or 0 if the buffer is shorter than SERIALIZED_STATE_SIZE.
+    std::size_t serializeState(std::span<uint8_t> buffer) const;
+    Status deserializeState(std::span<const uint8_t> buffer);
+
+    // XORs an 8-pixel-wide sprite of up to 15 rows into a display buffer
+    // and reports whether any lit pixel was turned off. The position always
+    // wraps; the sprite itself wraps too, or is cut at the edges if Clip.
+    template <bool Clip = false>
+    static bool drawSprite(
+        std::span<uint8_t, Chip8Hardware::DISPLAY_SIZE> display,
+        std::span<const uint8_t> sprite, int xPosition, int yPosition) {
+        return blitSprite<CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT, Clip, 1>(
+            display, sprite, xPosition, yPosition);
+    }
+
+#ifdef CHIP8_PROFILE
+    Chip8Profiler &getProfiler() { return profiler; }
+    const Chip8Profiler &getProfiler() const { return profiler; }
+#endif
 
   private:
+    // drawSprite for either resolution and for 8 or 16 pixel wide sprites
+    template <int Width, int Height, bool Clip, int SpriteBytes>
+    static bool blitSprite(std::span<uint8_t> display,
+                           std::span<const uint8_t> sprite, int xPosition,
+                           int yPosition);
+    // blitSprite() at the current resolution, 16x16 when `big`
+    template <bool Clip>
+    bool blitActive(std::span<uint8_t> display, std::span<const uint8_t> sprite,
+                    bool big, int xPosition, int yPosition);
+    // negative `down` scrolls up, negative `right` left
+    template <int Width, int Height>
+    static void scrollDisplay(std::span<uint8_t> display, int down, int right);
+    // scrolls the selected planes of whichever display is active and marks
+    // it all dirty
+    void scroll(int down, int right);
+    // 00FB and 00FC
+    static constexpr int SCROLL_COLUMNS = 4;
+
+    // An instruction decoded once per address. The handler is a plain
+    // function pointer so a cached entry stays small and the call is a
+    // single indirect jump.
+    struct DecodedInstruction;
+    using Handler = Status (*)(Chip8 &, const DecodedInstruction &);
+    struct DecodedInstruction {
+        Handler handler = nullptr;
+        uint16_t nnn = 0;
+        uint8_t x = 0;
+        uint8_t y = 0;
+        uint8_t n = 0;
+        uint8_t kk = 0;
+        // jumps, calls, skips, draws, key waits and memory writes
+        bool endsBlock = false;
+        // may start a busy-wait loop, see skipIdle()
+        bool mayIdle = false;
+    };
+
+    // One entry per even address below the display, decoded on first use.
+    // XO-CHIP code past it runs uncached.
+    static constexpr int DECODE_CACHE_LIMIT = Chip8Hardware::DISPLAY_START;
+    static constexpr int DECODE_CACHE_SIZE = DECODE_CACHE_LIMIT / 2;
+
+    uint16_t fetch(uint16_t address) const {
+        return hardware.MEMORY[address & addressMask] << 8 |
+               hardware.MEMORY[(address + 1) & addressMask];
+    }
+    // A block is a run of consecutive decode cache entries starting at a PC
+    // and ending at the first control flow, draw or memory write. Executing
+    // one is a walk down the handler pointers with no per-instruction fetch.
+    static constexpr int MAX_BLOCK_LENGTH = 64;
+
+    DecodedInstruction decode(uint16_t instruction) const;
+    // decode() plus the debugger's stand-ins for the instruction at `address`
+    DecodedInstruction decodeAt(uint16_t address) const;
+    // the SUPER-CHIP handler for `instruction`, or `handler` if it has none
+    static Handler decodeSuperChip(uint16_t instruction, Handler handler);
+    // the same for XO-CHIP
+    static Handler decodeXoChip(uint16_t instruction, Handler handler);
+    // step() without folding DISPLAY_WAIT into OK
+    Status execute();
+    void invalidateDecoded(int address, int length);
+    void invalidateAllDecoded() {
+        decodeCache.fill({});
+        blockLength.fill(0);
+    }
+    int compileBlock(int entry);
+    // Instructions of a provably idle loop starting at PC that can be
+    // retired at once from a budget of `cycles`, leaving the machine exactly
+    // as running them would. Covers FX0A with no key change, a jump to
+    // itself and the FX07/3XKK/1NNN delay-timer wait. Nothing is skipped
+    // past a breakpoint, in profiler builds or while coverage is recorded.
+    int skipIdle(const DecodedInstruction &op, int cycles);
+
+    template <Status (Chip8::*Op)(const DecodedInstruction &)>
+    static Status dispatch(Chip8 &chip8, const DecodedInstruction &op) {
+        return (chip8.*Op)(op);
+    }
+
+    Status op00E0(const DecodedInstruction &op);
+    Status op00EE(const DecodedInstruction &op);
+    Status op00CN(const DecodedInstruction &op);
+    Status op00DN(const DecodedInstruction &op);
+    Status op00FB(const DecodedInstruction &op);
+    Status op00FC(const DecodedInstruction &op);
+    Status op00FD(const DecodedInstruction &op);
+    Status op00FE(const DecodedInstruction &op);
+    Status op00FF(const DecodedInstruction &op);
+    Status op1NNN(const DecodedInstruction &op);
+    Status op2NNN(const DecodedInstruction &op);
+    // LongSkip: XO-CHIP skips all four bytes of an F000 NNNN
+    template <bool LongSkip> Status op3XKK(const DecodedInstruction &op);
+    template <bool LongSkip> Status op4XKK(const DecodedInstruction &op);
+    template <bool LongSkip> Status op5XY0(const DecodedInstruction &op);
+    Status op5XY2(const DecodedInstruction &op);
+    Status op5XY3(const DecodedInstruction &op);
+    Status op6XKK(const DecodedInstruction &op);
+    Status op7XKK(const DecodedInstruction &op);
+    Status op8XY0(const DecodedInstruction &op);
+    template <bool ResetVF> Status op8XY1(const DecodedInstruction &op);
+    template <bool ResetVF> Status op8XY2(const DecodedInstruction &op);
+    template <bool ResetVF> Status op8XY3(const DecodedInstruction &op);
+    Status op8XY4(const DecodedInstruction &op);
+    Status op8XY5(const DecodedInstruction &op);
+    template <bool UseVY> Status op8XY6(const DecodedInstruction &op);
+    Status op8XY7(const DecodedInstruction &op);
+    template <bool UseVY> Status op8XYE(const DecodedInstruction &op);
+    template <bool LongSkip> Status op9XY0(const DecodedInstruction &op);
+    Status opANNN(const DecodedInstruction &op);
+    template <bool UseVX> Status opBNNN(const DecodedInstruction &op);
+    Status opCXKK(const DecodedInstruction &op);
+    template <bool Clip, bool Wait>
+    Status opDXYN(const DecodedInstruction &op);
+    // DXYN with hi-res, DXY0 and planes, only decoded for SUPER-CHIP and
+    // XO-CHIP
+    template <bool Clip, bool Wait>
+    Status opDXYNSuper(const DecodedInstruction &op);
+    template <bool LongSkip> Status opEX9E(const DecodedInstruction &op);
+    template <bool LongSkip> Status opEXA1(const DecodedInstruction &op);
+    Status opF000(const DecodedInstruction &op);
+    Status opFX01(const DecodedInstruction &op);
+    Status opF002(const DecodedInstruction &op);
+    Status opFX07(const DecodedInstruction &op);
+    Status opFX0A(const DecodedInstruction &op);
+    Status opFX15(const DecodedInstruction &op);
+    Status opFX18(const DecodedInstruction &op);
+    Status opFX1E(const DecodedInstruction &op);
+    Status opFX29(const DecodedInstruction &op);
+    Status opFX30(const DecodedInstruction &op);
+    Status opFX33(const DecodedInstruction &op);
+    Status opFX3A(const DecodedInstruction &op);
+    template <IndexIncrement Increment>
+    Status opFX55(const DecodedInstruction &op);
+    template <IndexIncrement Increment>
+    Status opFX65(const DecodedInstruction &op);
+    Status opFX75(const DecodedInstruction &op);
+    Status opFX85(const DecodedInstruction &op);
+    Status opInvalid(const DecodedInstruction &op);
+    // debugger stand-ins; both run the real instruction when resumed
+    Status opBreakpoint(const DecodedInstruction &op);
+    Status opWatched(const DecodedInstruction &op);
+    Status runResumed();
+    // runCycles() while conditions are set
+    Status runCyclesChecked(int cycles);
+    bool conditionHolds(const Condition &condition) const;
+
+    std::span<uint8_t> displayBytes(int plane = 0) {
+        const int size = getDisplayWidth() * getDisplayHeight() / BITS_PER_BYTE;
+        if (plane) {
+            return std::span(hardware.SECOND_PLANE).first(size);
+        }
+        if (hardware.HIRES || quirks.xoChip) {
+            return std::span(hardware.HIRES_DISPLAY).first(size);
+        }
+        return std::span(hardware.MEMORY)
+            .subspan<Chip8Hardware::DISPLAY_START, Chip8Hardware::DISPLAY_SIZE>();
+    }
+    // the selected planes
     void clearDisplay() {
-        memset(&this->hardware.MEMORY[Chip8Hardware::DISPLAY_START], 0,
-               Chip8Hardware::DISPLAY_SIZE);
+        for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+            if (hardware.PLANES >> plane & 1) {
+                std::ranges::fill(displayBytes(plane), 0);
+            }
+        }
+        dirtyRows = ALL_ROWS_DIRTY;
+    }
+    // clears every plane, selected or not
+    void setHires(bool hires) {
+        hardware.HIRES = hires;
+        hardware.HIRES_DISPLAY.fill(0);
+        hardware.SECOND_PLANE.fill(0);
+        std::ranges::fill(displayBytes(), 0);
+        dirtyRows = ALL_ROWS_DIRTY;
+    }
+    // PC past the next instruction, all four bytes of it for an XO-CHIP
+    // F000 NNNN
+    template <bool LongSkip> void skipNext() {
+        hardware.PC += LongSkip && fetch(hardware.PC + 2) == 0xF000 ? 6 : 4;
+    }
+    // FX33/FX55 can store straight into the display area
+    void markDisplayWritten(int address, int length);
+    template <IndexIncrement Increment> void advanceIndex(int x) {
+        if constexpr (Increment == IndexIncrement::X) {
+            hardware.I += x;
+        } else if constexpr (Increment == IndexIncrement::X_PLUS_1) {
+            hardware.I += x + 1;
+        }
+    }
+    void loadFonts() {
+        memcpy(hardware.MEMORY.data(), Chip8Sprites::sprites.data(),
+               Chip8Sprites::SPRITE_MEMORY_SIZE);
+        memcpy(&hardware.MEMORY[Chip8Hardware::BIG_FONT_SET_START],
+               Chip8Sprites::bigSprites.data(),
+               Chip8Sprites::BIG_SPRITE_MEMORY_SIZE);
+    }
+    // program area back to `programImage`, zeroed past its end
+    void restoreProgram();
+    // I-indexed accesses of `length` bytes fault rather than run off
+    // the end of the addressable memory
+    bool indexFits(int length) const {
+        return hardware.I + length <= static_cast<int>(addressMask) + 1;
     }
-    void returnFromSubroutine();
-    void callSubroutine(const int nnn);
+    Status returnFromSubroutine();
+    Status callSubroutine(const int nnn);
     uint8_t getRandomByte() { return dist(gen); }
 
+    static_assert(CHIP8_DISPLAY_HEIGHT == 32, "dirty rows fit a uint32_t");
+    static constexpr uint32_t ALL_ROWS_DIRTY = ~0u;
+
     Chip8Hardware hardware;
+    // not owned, see loadProgram()
+    std::span<const uint8_t> programImage;
+    // starts dirty so the first frame is always drawn
+    uint32_t dirtyRows = ALL_ROWS_DIRTY;
+    // FX0A latches the first key pressed and completes on its release
+    bool waitingForKeyUp = false;
+    uint8_t keyPressed = 0;
     std::mt19937 gen;
     std::uniform_int_distribution<uint8_t> dist;
+    Quirks quirks;
+    // the addressable part of MEMORY less one, following quirks.xoChip
+    uint32_t addressMask = Chip8Hardware::CLASSIC_MEMORY_SIZE - 1;
+    std::array<DecodedInstruction, DECODE_CACHE_SIZE> decodeCache = {};
+    // instructions in the block starting at each entry, 0 if not compiled
+    std::array<uint8_t, DECODE_CACHE_SIZE> blockLength = {};
+    // records an event at `cycle` if the sound timer crossed zero since the
+    // last one
+    void trackSound(uint64_t cycle);
+    // the cycle the running handler executes at; blocks have no jumps
+    // before their last instruction, so PC gives the offset into one
+    uint64_t currentCycle() const {
+        return cycleCount + ((hardware.PC - blockEntry) >> 1);
+    }
+
+    uint64_t cycleCount = 0;
+    uint16_t blockEntry = 0;
+    bool soundOn = false;
+    std::array<SoundEvent, MAX_SOUND_EVENTS> soundEvents = {};
+    int soundEventCount = 0;
+
+    void recordEdge(uint16_t pc) {
+        const uint32_t location = (pc * 0x9E3779B1u) >> 16;
+        const uint32_t edge = (location ^ previousLocation) % COVERAGE_BITS;
+        (*coverage)[edge / BITS_PER_BYTE] |= 1 << (edge % BITS_PER_BYTE);
+        // halved so A->B and B->A, and tight loops, get different bits
+        previousLocation = location >> 1;
+    }
+    CoverageMap *coverage = nullptr;
+    uint32_t previousLocation = 0;
+
+    struct Watchpoint {
+        uint16_t address;
+        uint16_t length;
+        WatchKind kind;
+    };
+    std::bitset<Chip8Hardware::MEMORY_SIZE> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+    std::vector<Condition> conditions;
+    // which conditions held after the last instruction
+    uint32_t conditionsTrue = 0;
+    // the PC resume() lets past its stand-in, -1 for none
+    int resumePc = -1;
+    DebugEvent debugEvent;
+#ifdef CHIP8_PROFILE
+    Chip8Profiler profiler;
+    void profileStack() {
+        profiler.onStackChange(std::span(hardware.STACK).first(std::min<int>(
+                                   hardware.SP, Chip8Hardware::STACK_SIZE)),
+                               hardware.MEMORY);
+    }
+#endif
 };
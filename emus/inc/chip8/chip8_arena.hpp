@@ -0,0 +1,47 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// A fixed number of emulators stamped out of one golden instance, all in a
+// single cacheline-aligned block. Acquiring one is a bulk copy of the
+// golden machine, decode cache included, so churning through millions of
+// short runs never reaches the allocator, std::random_device or the
+// decoder. Not thread-safe; give each worker its own arena.
+class Chip8Arena {
+  public:
+    // `golden` is copied once; it should already be loaded, configured
+    // and precompiled
+    Chip8Arena(const Chip8 &golden, int capacity);
+    ~Chip8Arena();
+    Chip8Arena(const Chip8Arena &) = delete;
+    Chip8Arena &operator=(const Chip8Arena &) = delete;
+
+    // a fresh copy of the golden instance, reseeded if `seed` is set, or
+    // nullptr while all of them are out
+    Chip8 *acquire(std::optional<uint32_t> seed = std::nullopt);
+    // the next acquire() may hand it out again
+    void release(Chip8 *emulator);
+
+    const Chip8 &golden() const { return *slot(0); }
+    int capacity() const { return slotCount - 1; }
+
+  private:
+    struct Slot {
+        alignas(Chip8) std::byte bytes[sizeof(Chip8)];
+    };
+    Chip8 *slot(int index) const {
+        return std::launder(reinterpret_cast<Chip8 *>(slots[index].bytes));
+    }
+
+    // the golden instance lives in slot 0
+    std::unique_ptr<Slot[]> slots;
+    int slotCount;
+    // slots are only constructed the first time they are handed out
+    int constructed = 0;
+    std::vector<Chip8 *> released;
+};
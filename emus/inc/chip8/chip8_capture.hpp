@@ -0,0 +1,132 @@
+#pragma once
+
+#include "chip8.hpp"
+#include "spsc_ring.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <thread>
+#include <vector>
+
+// Lossless display capture, one record per emulated frame. A frame is
+// XORed with the one before it and the difference run-length coded, and
+// runs of identical frames collapse into one record, so a static screen
+// costs a byte every few seconds.
+class Chip8CaptureEncoder {
+  public:
+    // appends the file header to `out`
+    explicit Chip8CaptureEncoder(std::vector<uint8_t> &out);
+
+    // `display` is getDisplayBuffer() at getDisplayWidth() x
+    // getDisplayHeight()
+    void addFrame(std::span<const uint8_t> display, int width, int height,
+                  std::vector<uint8_t> &out);
+    // writes out a pending run of identical frames
+    void finish(std::vector<uint8_t> &out);
+
+  private:
+    std::array<uint8_t, Chip8::Chip8Hardware::HIRES_DISPLAY_SIZE> previous =
+        {};
+    int previousWidth = 0;
+    // identical frames not yet written
+    int repeats = 0;
+};
+
+class Chip8CaptureDecoder {
+  public:
+    struct Frame {
+        int width;
+        int height;
+        std::span<const uint8_t> display;
+    };
+
+    // nullopt unless `data` starts with a capture header; `data` must
+    // outlive the decoder
+    static std::optional<Chip8CaptureDecoder>
+    open(std::span<const uint8_t> data);
+
+    // The next frame, valid until the following call, or nullopt at the
+    // end of the data. corrupt() tells a clean end from a bad record.
+    std::optional<Frame> next();
+    bool corrupt() const { return isCorrupt; }
+
+  private:
+    explicit Chip8CaptureDecoder(std::span<const uint8_t> data)
+        : data(data) {}
+
+    std::span<const uint8_t> data;
+    std::size_t offset = 0;
+    std::array<uint8_t, Chip8::Chip8Hardware::HIRES_DISPLAY_SIZE> current =
+        {};
+    int width = 0;
+    int height = 0;
+    // copies of `current` still owed by a repeat record
+    int repeats = 0;
+    bool isCorrupt = false;
+};
+
+// Converters for players and editors. Low-res frames in a capture that
+// switches to SUPER-CHIP's hi-res are doubled so every frame has the same
+// size, then every pixel is scaled by `scale`. Both return false on a
+// corrupt capture or a failed write.
+class Chip8CaptureExport {
+  public:
+    // YUV4MPEG2 in the mono colour space, one raw frame per emulated frame
+    static bool toY4m(std::span<const uint8_t> capture, std::ostream &out,
+                      int scale);
+    // Animated PNG, 1 bit per pixel; identical frames become one longer
+    // frame. Deflate uses stored blocks, so pass it through an optimiser
+    // if size matters.
+    static bool toApng(std::span<const uint8_t> capture, std::ostream &out,
+                       int scale);
+};
+
+// Encodes and writes a capture on its own thread. push() copies the frame
+// into a bounded queue and returns at once, so emulation never waits on
+// the encoder or the disk; if the queue is ever full the frame is dropped
+// and counted. The thread sleeps until a frame arrives.
+class Chip8CaptureWriter {
+  public:
+    // nullptr if `path` cannot be created
+    static std::unique_ptr<Chip8CaptureWriter>
+    open(const std::filesystem::path &path);
+    // close()s if the owner did not
+    ~Chip8CaptureWriter();
+
+    // from the one thread running the emulator
+    void push(std::span<const uint8_t> display, int width, int height);
+    uint64_t droppedFrames() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+    // Drains the queue, finishes the capture and closes the file, once
+    // nothing pushes any more. False if a write failed, leaving the file
+    // cut short.
+    bool close();
+
+  private:
+    struct Frame {
+        std::array<uint8_t, Chip8::Chip8Hardware::HIRES_DISPLAY_SIZE> display;
+        int width;
+        int height;
+    };
+    // about four seconds of 60 Hz frames
+    static constexpr int QUEUE_FRAMES = 256;
+
+    explicit Chip8CaptureWriter(std::ofstream file);
+    void drain(std::stop_token stop);
+
+    std::ofstream file;
+    SpscRing<Frame, QUEUE_FRAMES> frames;
+    std::atomic<uint64_t> dropped = 0;
+    // bumped by every push and by the stop request; the thread waits on it
+    std::atomic<uint32_t> wakeups = 0;
+    std::atomic<bool> writeFailed = false;
+    // last, so it stops before the rest is destroyed
+    std::jthread encoderThread;
+};
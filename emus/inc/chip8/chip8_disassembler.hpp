@@ -0,0 +1,72 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Static analysis of a CHIP-8 memory image: mnemonics for single
+// instructions and a control-flow graph of everything reachable from an
+// entry point by following jumps, calls and skips. Nothing is executed, so
+// BNNN targets and stores through a computed I are reported rather than
+// followed.
+class Chip8Disassembler {
+  public:
+    // Cowgod's mnemonics, plus the SUPER-CHIP and XO-CHIP ones the quirks
+    // enable; "DW 0x1234" for anything Chip8::isValidInstruction() rejects.
+    // F000 is "LD I, LONG" without its operand, which is the next word.
+    static std::string disassemble(uint16_t instruction,
+                                   const Chip8Quirks &quirks);
+
+    struct BasicBlock {
+        uint16_t start = 0;
+        // one past the last instruction
+        uint16_t end = 0;
+        // fall-through, jump and skip targets, in address order
+        std::vector<uint16_t> successors;
+        // 2NNN target; the call returns to `end`
+        std::optional<uint16_t> call;
+        // ends in BNNN, whose target depends on V0 (or VX)
+        bool computedJump = false;
+        // ends in 00EE
+        bool returns = false;
+    };
+
+    // an FX33 or FX55 whose target I is known and overlaps reachable code
+    struct CodeWrite {
+        uint16_t pc;
+        uint16_t address;
+        uint16_t length;
+    };
+
+    struct ControlFlowGraph {
+        uint16_t entry = 0;
+        // the quirks the graph was built under
+        Chip8Quirks quirks;
+        // keyed by start address
+        std::map<uint16_t, BasicBlock> blocks;
+        // 2NNN targets, sorted
+        std::vector<uint16_t> subroutines;
+        std::vector<uint16_t> computedJumps;
+        std::vector<uint16_t> invalidInstructions;
+        std::vector<CodeWrite> selfModifying;
+        // stores through an I the analysis could not follow, which may
+        // write code too
+        std::vector<uint16_t> unresolvedStores;
+    };
+
+    // `memory` is the whole address space, ROM loaded at its usual place;
+    // `quirks` decide which opcodes are valid, as they do for the core
+    static ControlFlowGraph buildCfg(std::span<const uint8_t> memory,
+                                     uint16_t entry,
+                                     const Chip8Quirks &quirks);
+    // one line per reachable instruction, block by block, with the
+    // analysis findings as comments
+    static std::string listing(std::span<const uint8_t> memory,
+                               const ControlFlowGraph &cfg);
+    // the graph in Graphviz form, for `dot -Tsvg`
+    static std::string toDot(const ControlFlowGraph &cfg);
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "chip8.hpp"
+#include "chip8_movie.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Runs batches of independent ROM jobs across a work-stealing thread pool.
+// Every worker builds its own Chip8 per job, so nothing on the emulation
+// path is shared between threads.
+class Chip8Farm {
+  public:
+    using InputEvent = Chip8InputEvent;
+
+    struct Job {
+        std::string name;
+        // not owned, so many jobs can run the same image, typically one
+        // mapped by a Chip8RomCache that outlives the run
+        std::span<const uint8_t> rom;
+        // sorted by frame
+        std::vector<InputEvent> inputs;
+        // unset seeds come from std::random_device
+        std::optional<uint32_t> seed;
+        Chip8::Quirks quirks;
+        int frames = 600;
+        int instructionsPerFrame = 500;
+    };
+
+    struct JobResult {
+        std::string name;
+        Chip8::Status status = Chip8::Status::OK;
+        int framesRun = 0;
+        // FNV-1a over the final display buffer
+        uint64_t displayHash = 0;
+        std::string state;
+    };
+
+    struct Report {
+        // in job order
+        std::vector<JobResult> results;
+        int threads = 0;
+        double seconds = 0.0;
+    };
+
+    // threads <= 0 uses every hardware thread
+    explicit Chip8Farm(int threads = 0);
+
+    Report run(const std::vector<Job> &jobs) const;
+
+    static JobResult runJob(const Job &job);
+    // every plane the quirks give the machine
+    static uint64_t hashDisplay(const Chip8 &emulator);
+
+  private:
+    int threads;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+
+// Byte and word vectors holding one value per lane. Spelled out per width
+// because GCC drops vector_size on typedefs that depend on a template
+// parameter.
+template <int Lanes> struct Chip8LaneVectors;
+template <> struct Chip8LaneVectors<8> {
+    typedef uint8_t Bytes __attribute__((vector_size(8)));
+    typedef uint16_t Words __attribute__((vector_size(16)));
+    static void widen(Words &target, const Bytes &value) {
+        target = __builtin_convertvector(value, Words);
+    }
+    static void narrow(Bytes &target, const Words &value) {
+        target = __builtin_convertvector(value, Bytes);
+    }
+};
+template <> struct Chip8LaneVectors<16> {
+    typedef uint8_t Bytes __attribute__((vector_size(16)));
+    typedef uint16_t Words __attribute__((vector_size(32)));
+    static void widen(Words &target, const Bytes &value) {
+        target = __builtin_convertvector(value, Words);
+    }
+    static void narrow(Bytes &target, const Words &value) {
+        target = __builtin_convertvector(value, Bytes);
+    }
+};
+template <> struct Chip8LaneVectors<32> {
+    typedef uint8_t Bytes __attribute__((vector_size(32)));
+    typedef uint16_t Words __attribute__((vector_size(64)));
+    static void widen(Words &target, const Bytes &value) {
+        target = __builtin_convertvector(value, Words);
+    }
+    static void narrow(Bytes &target, const Words &value) {
+        target = __builtin_convertvector(value, Bytes);
+    }
+};
+
+// Steps `Lanes` CHIP-8 machines through the same ROM in lockstep, e.g. with
+// different inputs or RNG seeds. Registers, I, SP, keys and timers are stored
+// structure-of-arrays with one SIMD vector per architectural register, so
+// while every live lane sits on the same PC an ALU op, load, skip or timer
+// access runs for all machines at once with a single shared PC. Once a skip
+// or a scalar-only instruction splits them, each lane takes a scalar step
+// until their PCs meet again.
+//
+// Memory and stack stay one block per lane since they are addressed per lane
+// anyway. Lanes run classic CHIP-8, so each has only the 4 KB it can address
+// rather than XO-CHIP's 64 KB.
+template <int Lanes> class Chip8Lockstep {
+    static_assert(Lanes == 8 || Lanes == 16 || Lanes == 32,
+                  "lanes must fill SSE or AVX2 registers");
+
+  public:
+    using Hardware = Chip8::Chip8Hardware;
+    using Status = Chip8::Status;
+
+    // lane i seeds its RNG with seed + i
+    explicit Chip8Lockstep(uint32_t seed);
+
+    // loads the same program into every lane
+    Status loadProgram(std::span<const uint8_t> program);
+    void setKeyState(int lane, uint16_t keyState);
+
+    // One instruction on every live lane. A lane that fails stops and keeps
+    // its state; the first failure of the step is returned.
+    Status step();
+    Status runFrame(int instructionsPerFrame);
+    void decrementTimers();
+
+    Status getStatus(int lane) const { return status[lane]; }
+    std::span<const uint8_t, Hardware::DISPLAY_SIZE>
+    getDisplayBuffer(int lane) const;
+    // gathers one lane back into the Chip8 layout for inspection
+    Hardware getLaneHardware(int lane) const;
+
+    uint64_t getVectorSteps() const { return vectorSteps; }
+    uint64_t getScalarSteps() const { return scalarSteps; }
+
+  private:
+    using ByteLanes = typename Chip8LaneVectors<Lanes>::Bytes;
+    using WordLanes = typename Chip8LaneVectors<Lanes>::Words;
+
+    bool stepVector(uint16_t instruction);
+    Status stepLane(int lane);
+    // false if the lanes hold different code at the shared PC
+    bool sharedInstruction(uint16_t &instruction) const;
+    // hands the shared PC to every live lane before scalar steps
+    void diverge();
+    // rejoins once every live lane is back on the same PC
+    void tryConverge();
+
+    // writes only the live lanes so failed lanes keep their final state
+    void assign(ByteLanes &target, const ByteLanes &value) const {
+        target = allLive ? value : (value & live) | (target & ~live);
+    }
+    void assign(WordLanes &target, const WordLanes &value) const {
+        target = allLive ? value : (value & liveWords) | (target & ~liveWords);
+    }
+    void widen(WordLanes &target, const ByteLanes &value) const {
+        Chip8LaneVectors<Lanes>::widen(target, value);
+    }
+    void narrow(ByteLanes &target, const WordLanes &value) const {
+        Chip8LaneVectors<Lanes>::narrow(target, value);
+    }
+    // PC += 2, or 4 on the lanes where the 0/0xFF condition mask is set
+    void skipWhere(const ByteLanes &condition);
+
+    ByteLanes V[Hardware::REGISTER_COUNT] = {};
+    // per-lane PCs, only meaningful while the lanes are split
+    WordLanes PC = {};
+    WordLanes I = {};
+    WordLanes SP = {};
+    WordLanes KEY_STATE = {};
+    ByteLanes DELAY_TIMER = {};
+    ByteLanes SOUND_TIMER = {};
+
+    bool together = true;
+    uint16_t sharedPC = Hardware::PROGRAM_START;
+
+    ByteLanes live = {};
+    WordLanes liveWords = {};
+    bool allLive = true;
+    // first live lane, whose memory the shared path fetches from
+    int leader = 0;
+    std::array<Status, Lanes> status = {};
+
+    static constexpr int MEMORY_SIZE = Hardware::CLASSIC_MEMORY_SIZE;
+
+    std::array<std::array<uint8_t, MEMORY_SIZE>, Lanes> memory = {};
+    std::array<std::array<uint8_t, Hardware::STACK_SIZE>, Lanes> stack = {};
+    std::array<bool, Lanes> waitingForKeyUp = {};
+    std::array<uint8_t, Lanes> keyPressed = {};
+    std::array<std::mt19937, Lanes> gen;
+    std::uniform_int_distribution<uint8_t> dist;
+
+    // addresses any lane has stored to; lanes may hold different code there
+    std::bitset<MEMORY_SIZE> written;
+
+    uint64_t vectorSteps = 0;
+    uint64_t scalarSteps = 0;
+};
+
+extern template class Chip8Lockstep<8>;
+extern template class Chip8Lockstep<16>;
+extern template class Chip8Lockstep<32>;
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Keypad state to apply from the start of `frame` onwards.
+struct Chip8InputEvent {
+    uint32_t frame;
+    uint16_t keyState;
+};
+
+// Everything needed to replay a run bit for bit: the RNG seed, the quirks,
+// the per-frame instruction budget and the keypad state whenever it changed.
+// Keys are sampled at frame boundaries, which is the only place the
+// platforms apply them, so a replay sees exactly what the run saw.
+struct Chip8Movie {
+    static constexpr uint32_t VERSION = 2;
+
+    uint32_t seed = 0;
+    Chip8::Quirks quirks;
+    int instructionsPerFrame = 0;
+    // non-zero when the budget followed an emulated clock instead
+    int cpuHz = 0;
+    uint32_t frames = 0;
+    // FNV-1a of the ROM, to catch replays against the wrong program
+    uint64_t romHash = 0;
+    // sorted by frame
+    std::vector<Chip8InputEvent> inputs;
+
+    // logs the keypad for `frame` if it changed since the last event
+    void record(uint32_t frame, uint16_t keyState);
+
+    std::vector<uint8_t> serialize() const;
+    static std::optional<Chip8Movie> deserialize(std::span<const uint8_t> data);
+    static uint64_t hashRom(std::span<const uint8_t> rom);
+};
+
+// Feeds a sorted input list to an emulator frame by frame.
+class Chip8InputPlayback {
+  public:
+    explicit Chip8InputPlayback(std::span<const Chip8InputEvent> inputs)
+        : inputs(inputs) {}
+
+    // applies every event due at or before `frame`
+    void apply(Chip8 &emulator, uint32_t frame) {
+        while (next < inputs.size() && inputs[next].frame <= frame) {
+            emulator.setKeyState(inputs[next].keyState);
+            next++;
+        }
+    }
+
+  private:
+    std::span<const Chip8InputEvent> inputs;
+    std::size_t next = 0;
+};
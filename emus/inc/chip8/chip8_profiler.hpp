@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Execution counters for one Chip8, filled in by hooks in the core when it
+// is built with CHIP8_PROFILE. Without that define the hooks and the
+// Chip8::getProfiler() member do not exist, so normal builds pay nothing.
+class Chip8Profiler {
+  public:
+    // XO-CHIP's whole address space
+    static constexpr int ADDRESS_COUNT = 0x10000;
+
+    // one per handler in Chip8::decode, plus anything it rejects
+    enum class OpcodeClass : uint8_t {
+        OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XKK, OP_4XKK, OP_5XY0,
+        OP_6XKK, OP_7XKK, OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4,
+        OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE, OP_9XY0, OP_ANNN, OP_BNNN,
+        OP_CXKK, OP_DXYN, OP_EX9E, OP_EXA1, OP_FX07, OP_FX0A, OP_FX15,
+        OP_FX18, OP_FX1E, OP_FX29, OP_FX33, OP_FX55, OP_FX65, OP_00CN,
+        OP_00FB, OP_00FC, OP_00FD, OP_00FE, OP_00FF, OP_FX30, OP_FX75,
+        OP_FX85, OP_00DN, OP_5XY2, OP_5XY3, OP_F000, OP_FX01, OP_F002,
+        OP_FX3A, INVALID, COUNT
+    };
+    static OpcodeClass classify(uint16_t instruction);
+    static std::string_view getName(OpcodeClass opcodeClass);
+
+    Chip8Profiler();
+
+    void onInstruction(uint16_t pc, uint16_t instruction) {
+        opcodeCounts[static_cast<int>(classify(instruction))]++;
+        pcCounts[pc & (ADDRESS_COUNT - 1)]++;
+        stackCounts[currentStack]++;
+    }
+    // FX0A ran without completing
+    void onKeyWait() { keyWaitCycles++; }
+    void onDraw(bool collided) {
+        draws++;
+        collisions += collided;
+    }
+    // Re-resolves the current call stack from the live STACK bytes below
+    // SP, so it survives save-state loads and stray writes. `memory` is
+    // used to read the CALL at each return address for its target.
+    void onStackChange(std::span<const uint8_t> stack,
+                       std::span<const uint8_t> memory);
+    void clear();
+
+    uint64_t getOpcodeCount(OpcodeClass opcodeClass) const {
+        return opcodeCounts[static_cast<int>(opcodeClass)];
+    }
+    uint64_t getPcCount(uint16_t pc) const {
+        return pcCounts[pc & (ADDRESS_COUNT - 1)];
+    }
+    uint64_t getInstructions() const;
+    uint64_t getKeyWaitCycles() const { return keyWaitCycles; }
+    uint64_t getDraws() const { return draws; }
+    uint64_t getCollisions() const { return collisions; }
+
+    // opcode classes and the `topPcs` hottest addresses, busiest first
+    std::string report(int topPcs = 20) const;
+    // one "main;sub_0x2A4;sub_0x310 <count>" line per call stack seen, the
+    // input flamegraph.pl and speedscope expect
+    std::string foldedStacks() const;
+
+  private:
+    // A node per distinct call path; 0 is the program's top level.
+    struct StackNode {
+        uint32_t parent;
+        uint16_t entry;
+    };
+    uint32_t childOf(uint32_t parent, uint16_t entry);
+
+    std::array<uint64_t, static_cast<int>(OpcodeClass::COUNT)> opcodeCounts;
+    std::vector<uint64_t> pcCounts;
+    uint64_t keyWaitCycles = 0;
+    uint64_t draws = 0;
+    uint64_t collisions = 0;
+
+    std::vector<StackNode> stackNodes;
+    std::vector<uint64_t> stackCounts;
+    std::map<std::pair<uint32_t, uint16_t>, uint32_t> stackChildren;
+    uint32_t currentStack = 0;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Keeps the most recent per-frame states of one Chip8 in a fixed-size byte
+// arena. The newest frame is held whole; every older frame is stored as the
+// run-length encoded XOR against the frame after it. A frame rarely touches
+// more than a handful of bytes, so most records are a few dozen bytes, and
+// stepping back is one small decode onto the newest state.
+//
+// When the arena or the frame limit is full the oldest record is evicted.
+// Nothing allocates after construction.
+class Chip8Rewind {
+  public:
+    // keeps at least two frames whatever maxFrames says
+    Chip8Rewind(int maxFrames, std::size_t capacityBytes);
+
+    // records the emulator's current state, once per frame
+    void push(const Chip8 &emulator);
+    // Drops the newest frame and restores the one before it. False, with
+    // the emulator untouched, once only one frame is left.
+    bool stepBack(Chip8 &emulator);
+    void clear();
+
+    int getFramesStored() const { return recordCount + (hasNewest ? 1 : 0); }
+    // encoded deltas plus the whole newest state
+    std::size_t getBytesUsed() const {
+        return bytesUsed + (hasNewest ? STATE_SIZE : 0);
+    }
+    std::size_t getCapacityBytes() const { return arena.size() + STATE_SIZE; }
+
+  private:
+    struct Record {
+        std::size_t offset;
+        uint32_t size;
+    };
+
+    static constexpr std::size_t STATE_SIZE = sizeof(Chip8::Snapshot);
+    // A record is a list of segments: a uint32_t count of unchanged bytes,
+    // a uint32_t count of changed bytes, then the changed bytes XORed.
+    static constexpr std::size_t SEGMENT_HEADER_SIZE = 2 * sizeof(uint32_t);
+    // Zero runs shorter than a header are folded into the literal, so every
+    // segment after the first costs at most the bytes it covers.
+    static constexpr std::size_t MAX_ENCODED_SIZE =
+        STATE_SIZE + SEGMENT_HEADER_SIZE;
+
+    // RLE of `state ^ base` into `out`, which must hold MAX_ENCODED_SIZE
+    static std::size_t encode(std::span<const uint8_t> state,
+                              std::span<const uint8_t> base,
+                              std::span<uint8_t> out);
+    // XORs an encoded record onto `state`
+    static void decode(std::span<const uint8_t> record,
+                       std::span<uint8_t> state);
+
+    // first byte of a free run of `size` bytes, evicting as needed
+    std::size_t reserve(std::size_t size);
+    void evictOldest();
+
+    const int maxRecords;
+
+    std::vector<uint8_t> arena;
+    std::size_t writeOffset = 0;
+    std::size_t bytesUsed = 0;
+
+    // ring of records, oldest at recordHead
+    std::vector<Record> records;
+    int recordHead = 0;
+    int recordCount = 0;
+
+    bool hasNewest = false;
+    std::vector<uint8_t> newestState;
+    std::vector<uint8_t> scratchState;
+    std::vector<uint8_t> scratchRecord;
+    // reused so its padding bytes stay stable and never show up as deltas
+    Chip8::Snapshot snapshot;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only ROM images mapped once and shared by every emulator that runs
+// them. Opens a single ROM, a directory of ROMs or an archive packed by
+// pack(); pages are read on first touch and an image is only ever copied
+// into an emulator's memory.
+class Chip8RomCache {
+  public:
+    struct Rom {
+        std::string name;
+        // valid for the cache's lifetime, moves included
+        std::span<const uint8_t> image;
+    };
+
+    // nullopt if the path, a file in the directory or the archive cannot
+    // be mapped or is malformed
+    static std::optional<Chip8RomCache> open(const std::filesystem::path &path);
+
+    // a single file, sorted file names for a directory, archive order
+    std::span<const Rom> roms() const { return entries; }
+    const Rom *find(std::string_view name) const;
+
+    // the archive open() recognises, ROMs in the given order
+    static std::vector<uint8_t> pack(std::span<const Rom> roms);
+
+  private:
+    struct Unmap {
+        std::size_t length;
+        void operator()(const uint8_t *address) const;
+    };
+    using Mapping = std::unique_ptr<const uint8_t, Unmap>;
+
+    // appends `path` as one ROM, or its entries if it is an archive
+    bool add(const std::filesystem::path &path);
+
+    std::vector<Mapping> mappings;
+    std::vector<Rom> entries;
+};
@@ -1,37 +1,203 @@
 #include "chip8.hpp"
+#include "chip8_disassembler.hpp"
+#include <algorithm>
 #include <bit>
+#include <cstddef>
+#include <cstdlib>
+#include <sstream>
+#include <type_traits>
 
-Chip8::Status Chip8::loadProgram(std::vector<uint8_t> program) {
-    auto size = program.size();
-    if (size + Chip8Hardware::PROGRAM_START > Chip8Hardware::MEMORY_SIZE) {
+// Profiler hooks, gone entirely unless the core is built with CHIP8_PROFILE.
+#ifdef CHIP8_PROFILE
+#define PROFILE(hook) hook
+#else
+#define PROFILE(hook)
+#endif
+
+Chip8::Status Chip8::loadProgram(std::span<const uint8_t> program) {
+    if (program.size() + Chip8Hardware::PROGRAM_START > addressMask + 1) {
         // SDL_Log("ROM exceeds max size\n");
         return Status::ROM_OVERSIZED;
     }
 
-    std::memcpy(&hardware.MEMORY[Chip8Hardware::PROGRAM_START], program.data(),
-                size);
+    programImage = program;
+    restoreProgram();
+    dirtyRows = ALL_ROWS_DIRTY;
     return Status::OK;
 }
 
-const std::span<const uint8_t, Chip8::Chip8Hardware::DISPLAY_SIZE>
-Chip8::getDisplayBuffer() const {
+void Chip8::reset(std::optional<uint32_t> seed) {
+    hardware = Chip8Hardware{};
+    loadFonts();
+    restoreProgram();
+    waitingForKeyUp = false;
+    keyPressed = 0;
+    dirtyRows = ALL_ROWS_DIRTY;
+    cycleCount = 0;
+    blockEntry = 0;
+    soundOn = false;
+    soundEventCount = 0;
+    conditionsTrue = 0;
+    resumePc = -1;
+    previousLocation = 0;
+    if (seed) {
+        reseed(*seed);
+    }
+    PROFILE(profileStack());
+}
+
+void Chip8::restoreProgram() {
+    std::memcpy(&hardware.MEMORY[Chip8Hardware::PROGRAM_START],
+                programImage.data(), programImage.size());
+    // whatever an earlier program or run left past the image, up to the
+    // display unless XO-CHIP keeps that elsewhere
+    const std::size_t end = Chip8Hardware::PROGRAM_START + programImage.size();
+    const std::size_t limit = quirks.xoChip ? Chip8Hardware::MEMORY_SIZE
+                                            : Chip8Hardware::DISPLAY_START;
+    if (end < limit) {
+        std::fill(&hardware.MEMORY[end], &hardware.MEMORY[limit], 0);
+    }
+    invalidateAllDecoded();
+}
+
+void Chip8::precompile() {
+    const auto cfg =
+        Chip8Disassembler::buildCfg(getMemory(), hardware.PC, quirks);
+    for (const auto &[start, block] : cfg.blocks) {
+        // engine blocks also end at draws and stores, so walk the whole
+        // basic block a block at a time, the way execution would reach them
+        for (int address = start;
+             !(address & 1) && address < std::min<int>(block.end,
+                                                         DECODE_CACHE_LIMIT);) {
+            const int entry = address >> 1;
+            address += 2 * (blockLength[entry] ? blockLength[entry]
+                                               : compileBlock(entry));
+        }
+    }
+}
+
+std::span<const uint8_t> Chip8::getDisplayBuffer(int plane) const {
+    const int size = getDisplayWidth() * getDisplayHeight() / BITS_PER_BYTE;
+    if (plane) {
+        return std::span(hardware.SECOND_PLANE).first(size);
+    }
+    if (hardware.HIRES || quirks.xoChip) {
+        return std::span(hardware.HIRES_DISPLAY).first(size);
+    }
     return std::span(hardware.MEMORY)
         .subspan<Chip8Hardware::DISPLAY_START, Chip8Hardware::DISPLAY_SIZE>();
 }
 
-void Chip8::returnFromSubroutine() {
+Chip8::Status Chip8::returnFromSubroutine() {
+    if (hardware.SP < 2) [[unlikely]] {
+        return Status::STACK_UNDERFLOW;
+    }
     hardware.SP -= 2;
     uint16_t storedSP =
         (hardware.STACK[hardware.SP] << 8 | hardware.STACK[hardware.SP + 1]);
     hardware.PC = storedSP;
     hardware.PC += 2;
+    return Status::OK;
 }
 
-void Chip8::callSubroutine(const int nnn) {
+Chip8::Status Chip8::callSubroutine(const int nnn) {
+    if (hardware.SP + 2 > Chip8Hardware::STACK_SIZE) [[unlikely]] {
+        return Status::STACK_OVERFLOW;
+    }
     hardware.STACK[hardware.SP] = (hardware.PC >> 8);
     hardware.STACK[hardware.SP + 1] = hardware.PC & 0xFF;
     hardware.SP += 2;
     hardware.PC = nnn;
+    return Status::OK;
+}
+
+static_assert(std::is_trivially_copyable_v<Chip8::Snapshot>);
+// serializeState() needs offsetof
+static_assert(std::is_standard_layout_v<Chip8::Snapshot>);
+
+namespace {
+constexpr uint32_t STATE_MAGIC = 0x54533843; // "C8ST" little-endian
+// granularity at which a restore compares code to keep decoded blocks
+constexpr int STATE_COMPARE_CHUNK = 64;
+} // namespace
+
+void Chip8::saveState(Snapshot &snapshot) const {
+    snapshot.hardware = hardware;
+    snapshot.gen = gen;
+    snapshot.waitingForKeyUp = waitingForKeyUp;
+    snapshot.keyPressed = keyPressed;
+}
+
+void Chip8::loadState(const Snapshot &snapshot) {
+    // runs branched from one snapshot mostly differ in data, so only drop
+    // decoded code whose bytes actually change
+    for (int chunk = 0; chunk < DECODE_CACHE_LIMIT;
+         chunk += STATE_COMPARE_CHUNK) {
+        if (memcmp(&hardware.MEMORY[chunk], &snapshot.hardware.MEMORY[chunk],
+                   STATE_COMPARE_CHUNK) != 0) {
+            invalidateDecoded(chunk, STATE_COMPARE_CHUNK);
+        }
+    }
+    hardware = snapshot.hardware;
+    gen = snapshot.gen;
+    waitingForKeyUp = snapshot.waitingForKeyUp;
+    keyPressed = snapshot.keyPressed;
+    dirtyRows = ALL_ROWS_DIRTY;
+    trackSound(cycleCount);
+    PROFILE(profileStack());
+}
+
+std::size_t Chip8::serializeState(std::span<uint8_t> buffer) const {
+    if (buffer.size() < SERIALIZED_STATE_SIZE) {
+        return 0;
+    }
+    const uint32_t header[] = {STATE_MAGIC, STATE_VERSION,
+                               static_cast<uint32_t>(sizeof(Snapshot))};
+    memcpy(buffer.data(), header, sizeof(header));
+    // Field by field into a zeroed payload: a struct copy would carry its
+    // padding along, and with it whatever was on the stack.
+    uint8_t *payload = buffer.data() + sizeof(header);
+    memset(payload, 0, sizeof(Snapshot));
+    auto put = [&](std::size_t offset, const auto &field) {
+        memcpy(payload + offset, &field, sizeof(field));
+    };
+    constexpr std::size_t HW = offsetof(Snapshot, hardware);
+    put(HW + offsetof(Chip8Hardware, MEMORY), hardware.MEMORY);
+    put(HW + offsetof(Chip8Hardware, REGISTERS), hardware.REGISTERS);
+    put(HW + offsetof(Chip8Hardware, STACK), hardware.STACK);
+    put(HW + offsetof(Chip8Hardware, KEY_STATE), hardware.KEY_STATE);
+    put(HW + offsetof(Chip8Hardware, PC), hardware.PC);
+    put(HW + offsetof(Chip8Hardware, SP), hardware.SP);
+    put(HW + offsetof(Chip8Hardware, I), hardware.I);
+    put(HW + offsetof(Chip8Hardware, DELAY_TIMER), hardware.DELAY_TIMER);
+    put(HW + offsetof(Chip8Hardware, SOUND_TIMER), hardware.SOUND_TIMER);
+    put(HW + offsetof(Chip8Hardware, HIRES), hardware.HIRES);
+    put(HW + offsetof(Chip8Hardware, RPL_FLAGS), hardware.RPL_FLAGS);
+    put(HW + offsetof(Chip8Hardware, HIRES_DISPLAY), hardware.HIRES_DISPLAY);
+    put(HW + offsetof(Chip8Hardware, SECOND_PLANE), hardware.SECOND_PLANE);
+    put(HW + offsetof(Chip8Hardware, PLANES), hardware.PLANES);
+    put(HW + offsetof(Chip8Hardware, PITCH), hardware.PITCH);
+    put(HW + offsetof(Chip8Hardware, AUDIO_PATTERN), hardware.AUDIO_PATTERN);
+    put(offsetof(Snapshot, gen), gen);
+    put(offsetof(Snapshot, waitingForKeyUp), waitingForKeyUp);
+    put(offsetof(Snapshot, keyPressed), keyPressed);
+    return SERIALIZED_STATE_SIZE;
+}
+
+Chip8::Status Chip8::deserializeState(std::span<const uint8_t> buffer) {
+    uint32_t header[3];
+    if (buffer.size() < SERIALIZED_STATE_SIZE) {
+        return Status::INVALID_STATE;
+    }
+    memcpy(header, buffer.data(), sizeof(header));
+    if (header[0] != STATE_MAGIC || header[1] != STATE_VERSION ||
+        header[2] != sizeof(Snapshot)) {
+        return Status::INVALID_STATE;
+    }
+    Snapshot state;
+    memcpy(&state, buffer.data() + sizeof(header), sizeof(state));
+    loadState(state);
+    return Status::OK;
 }
 
 void Chip8::handleKeyUp(uint8_t chip8code) {
@@ -48,321 +214,1370 @@ void Chip8::handleKeyDown(uint8_t chip8code) {
     hardware.KEY_STATE |= 1 << chip8code;
 }
 
-Chip8::Status Chip8::step() {
-    const uint16_t instruction =
-        (hardware.MEMORY[hardware.PC] << 8 | hardware.MEMORY[hardware.PC + 1]);
-    const int xRegisterIdx = (instruction & 0x0F00) >> 8;
-    const int yRegisterIdx = (instruction & 0x00F0) >> 4;
-    const int nnn = (instruction & 0x0FFF);
-    const int n = (instruction & 0x000F);
-    const int kk = (instruction & 0x00FF);
+std::optional<Chip8::Quirks> Chip8::findQuirks(std::string_view name) {
+    if (name == "modern") {
+        return MODERN_QUIRKS;
+    } else if (name == "vip") {
+        return COSMAC_VIP_QUIRKS;
+    } else if (name == "chip48") {
+        return CHIP48_QUIRKS;
+    } else if (name == "schip") {
+        return SCHIP_QUIRKS;
+    } else if (name == "xochip") {
+        return XO_CHIP_QUIRKS;
+    }
+    return std::nullopt;
+}
+
+bool Chip8::isValidInstruction(uint16_t instruction, const Quirks &quirks) {
+    switch (instruction >> 12) {
+    case 0x0:
+        return instruction == 0x00E0 || instruction == 0x00EE ||
+               (quirks.superChip &&
+                ((instruction & 0xFFF0) == 0x00C0 ||
+                 (instruction >= 0x00FB && instruction <= 0x00FF))) ||
+               (quirks.xoChip && (instruction & 0xFFF0) == 0x00D0);
+    case 0x8:
+        return (instruction & 0xF) <= 0x7 || (instruction & 0xF) == 0xE;
+    case 0xE:
+        return (instruction & 0xFF) == 0x9E || (instruction & 0xFF) == 0xA1;
+    case 0xF:
+        switch (instruction & 0xFF) {
+        case 0x07:
+        case 0x0A:
+        case 0x15:
+        case 0x18:
+        case 0x1E:
+        case 0x29:
+        case 0x33:
+        case 0x55:
+        case 0x65:
+            return true;
+        case 0x30:
+        case 0x75:
+        case 0x85:
+            return quirks.superChip;
+        case 0x00:
+        case 0x02:
+            // F000 NNNN and F002 take no register
+            return quirks.xoChip && (instruction & 0x0F00) == 0;
+        case 0x01:
+            // planes 0 to 3
+            return quirks.xoChip && (instruction & 0x0F00) <= 0x0300;
+        case 0x3A:
+            return quirks.xoChip;
+        default:
+            return false;
+        }
+    default:
+        return true;
+    }
+}
+
+Chip8::DecodedInstruction Chip8::decode(uint16_t instruction) const {
+    DecodedInstruction op;
+    op.x = (instruction & 0x0F00) >> 8;
+    op.y = (instruction & 0x00F0) >> 4;
+    op.nnn = (instruction & 0x0FFF);
+    op.n = (instruction & 0x000F);
+    op.kk = (instruction & 0x00FF);
+    if (!isValidInstruction(instruction, quirks)) {
+        op.handler = &dispatch<&Chip8::opInvalid>;
+        op.endsBlock = true;
+        return op;
+    }
+
+    static constexpr std::array<Handler, 16> arithmeticHandlers = {
+        &dispatch<&Chip8::op8XY0>,
+        &dispatch<&Chip8::op8XY1<false>>,
+        &dispatch<&Chip8::op8XY2<false>>,
+        &dispatch<&Chip8::op8XY3<false>>,
+        &dispatch<&Chip8::op8XY4>,
+        &dispatch<&Chip8::op8XY5>,
+        &dispatch<&Chip8::op8XY6<false>>,
+        &dispatch<&Chip8::op8XY7>,
+        &dispatch<&Chip8::opInvalid>,
+        &dispatch<&Chip8::opInvalid>,
+        &dispatch<&Chip8::opInvalid>,
+        &dispatch<&Chip8::opInvalid>,
+        &dispatch<&Chip8::opInvalid>,
+        &dispatch<&Chip8::opInvalid>,
+        &dispatch<&Chip8::op8XYE<false>>,
+        &dispatch<&Chip8::opInvalid>,
+    };
+    // the quirk variants, picked here once per decode
+    static constexpr Handler resettingLogicHandlers[] = {
+        &dispatch<&Chip8::op8XY1<true>>,
+        &dispatch<&Chip8::op8XY2<true>>,
+        &dispatch<&Chip8::op8XY3<true>>,
+    };
+    static constexpr Handler drawHandlers[2][2] = {
+        {&dispatch<&Chip8::opDXYN<false, false>>,
+         &dispatch<&Chip8::opDXYN<false, true>>},
+        {&dispatch<&Chip8::opDXYN<true, false>>,
+         &dispatch<&Chip8::opDXYN<true, true>>},
+    };
+    // the skips, without and with XO-CHIP's long ones
+    static constexpr Handler skipHandlers[6][2] = {
+        {&dispatch<&Chip8::op3XKK<false>>, &dispatch<&Chip8::op3XKK<true>>},
+        {&dispatch<&Chip8::op4XKK<false>>, &dispatch<&Chip8::op4XKK<true>>},
+        {&dispatch<&Chip8::op5XY0<false>>, &dispatch<&Chip8::op5XY0<true>>},
+        {&dispatch<&Chip8::op9XY0<false>>, &dispatch<&Chip8::op9XY0<true>>},
+        {&dispatch<&Chip8::opEX9E<false>>, &dispatch<&Chip8::opEX9E<true>>},
+        {&dispatch<&Chip8::opEXA1<false>>, &dispatch<&Chip8::opEXA1<true>>},
+    };
+    static constexpr Handler superDrawHandlers[2][2] = {
+        {&dispatch<&Chip8::opDXYNSuper<false, false>>,
+         &dispatch<&Chip8::opDXYNSuper<false, true>>},
+        {&dispatch<&Chip8::opDXYNSuper<true, false>>,
+         &dispatch<&Chip8::opDXYNSuper<true, true>>},
+    };
+    static constexpr Handler storeHandlers[] = {
+        &dispatch<&Chip8::opFX55<IndexIncrement::NONE>>,
+        &dispatch<&Chip8::opFX55<IndexIncrement::X>>,
+        &dispatch<&Chip8::opFX55<IndexIncrement::X_PLUS_1>>,
+    };
+    static constexpr Handler loadHandlers[] = {
+        &dispatch<&Chip8::opFX65<IndexIncrement::NONE>>,
+        &dispatch<&Chip8::opFX65<IndexIncrement::X>>,
+        &dispatch<&Chip8::opFX65<IndexIncrement::X_PLUS_1>>,
+    };
 
     switch ((instruction & 0xF000) >> 12) {
-    case 0x0: {
+    case 0x0:
         switch (instruction) {
-        case 0x00E0: {
-            clearDisplay();
-            hardware.PC += 2;
+        case 0x00E0:
+            op.handler = &dispatch<&Chip8::op00E0>;
             break;
-        }
-        case 0x00EE: {
-            returnFromSubroutine();
+        case 0x00EE:
+            op.handler = &dispatch<&Chip8::op00EE>;
+            break;
+        default:
+            op.handler = &dispatch<&Chip8::opInvalid>;
             break;
         }
-        default: {
-            return Status::INVALID_INSTRUCTION;
+        if (quirks.superChip) {
+            op.handler = decodeSuperChip(instruction, op.handler);
         }
+        if (quirks.xoChip) {
+            op.handler = decodeXoChip(instruction, op.handler);
         }
         break;
-    }
-    case 0x1: {
-        hardware.PC = nnn;
+    case 0x1:
+        op.handler = &dispatch<&Chip8::op1NNN>;
         break;
-    }
-    case 0x2: {
-        callSubroutine(nnn);
+    case 0x2:
+        op.handler = &dispatch<&Chip8::op2NNN>;
         break;
-    }
-    case 0x3: {
-        int registerValue = hardware.REGISTERS[xRegisterIdx];
-        if (kk == registerValue) {
-            hardware.PC += 4;
-        } else {
-            hardware.PC += 2;
-        }
+    case 0x3:
+        op.handler = skipHandlers[0][quirks.xoChip];
         break;
-    }
-    case 0x4: {
-        int registerValue = hardware.REGISTERS[xRegisterIdx];
-        if (kk != registerValue) {
-            hardware.PC += 4;
-        } else {
-            hardware.PC += 2;
+    case 0x4:
+        op.handler = skipHandlers[1][quirks.xoChip];
+        break;
+    case 0x5:
+        op.handler = skipHandlers[2][quirks.xoChip];
+        if (quirks.xoChip) {
+            op.handler = decodeXoChip(instruction, op.handler);
         }
         break;
-    }
-    case 0x5: {
-        int xRegister = hardware.REGISTERS[xRegisterIdx];
-        int yRegister = hardware.REGISTERS[yRegisterIdx];
-        if (xRegister == yRegister) {
-            hardware.PC += 4;
-        } else {
-            hardware.PC += 2;
+    case 0x6:
+        op.handler = &dispatch<&Chip8::op6XKK>;
+        break;
+    case 0x7:
+        op.handler = &dispatch<&Chip8::op7XKK>;
+        break;
+    case 0x8:
+        op.handler = arithmeticHandlers[op.n];
+        if (quirks.logicResetsVF && op.n >= 0x1 && op.n <= 0x3) {
+            op.handler = resettingLogicHandlers[op.n - 1];
+        } else if (quirks.shiftUsesVY && op.n == 0x6) {
+            op.handler = &dispatch<&Chip8::op8XY6<true>>;
+        } else if (quirks.shiftUsesVY && op.n == 0xE) {
+            op.handler = &dispatch<&Chip8::op8XYE<true>>;
         }
         break;
-    }
-    case 0x6: {
-        uint8_t instructionValue = static_cast<uint8_t>(instruction & 0x00FF);
-        hardware.REGISTERS[xRegisterIdx] = instructionValue;
-        hardware.PC += 2;
+    case 0x9:
+        op.handler = skipHandlers[3][quirks.xoChip];
         break;
-    }
-    case 0x7: {
-        hardware.REGISTERS[xRegisterIdx] += kk;
-        hardware.PC += 2;
+    case 0xA:
+        op.handler = &dispatch<&Chip8::opANNN>;
         break;
-    }
-    case 0x8: {
-        switch (instruction & 0xF) {
-        case 0x0: {
-            hardware.REGISTERS[xRegisterIdx] = hardware.REGISTERS[yRegisterIdx];
+    case 0xB:
+        op.handler = quirks.jumpUsesVX ? &dispatch<&Chip8::opBNNN<true>>
+                                       : &dispatch<&Chip8::opBNNN<false>>;
+        break;
+    case 0xC:
+        op.handler = &dispatch<&Chip8::opCXKK>;
+        break;
+    case 0xD:
+        op.handler = quirks.superChip || quirks.xoChip
+                         ? superDrawHandlers[quirks.clipSprites]
+                                            [quirks.displayWait]
+                         : drawHandlers[quirks.clipSprites][quirks.displayWait];
+        break;
+    case 0xE:
+        switch (op.kk) {
+        case 0x9E:
+            op.handler = skipHandlers[4][quirks.xoChip];
             break;
-        }
-        case 0x1: {
-            hardware.REGISTERS[xRegisterIdx] |=
-                hardware.REGISTERS[yRegisterIdx];
+        case 0xA1:
+            op.handler = skipHandlers[5][quirks.xoChip];
             break;
-        }
-        case 0x2: {
-            hardware.REGISTERS[xRegisterIdx] &=
-                hardware.REGISTERS[yRegisterIdx];
+        default:
+            op.handler = &dispatch<&Chip8::opInvalid>;
             break;
         }
-        case 0x3: {
-            hardware.REGISTERS[xRegisterIdx] ^=
-                hardware.REGISTERS[yRegisterIdx];
+        break;
+    case 0xF:
+        switch (op.kk) {
+        case 0x07:
+            op.handler = &dispatch<&Chip8::opFX07>;
             break;
-        }
-        case 0x4: {
-            int total = hardware.REGISTERS[xRegisterIdx] +
-                        hardware.REGISTERS[yRegisterIdx];
-            if (total > std::numeric_limits<uint8_t>::max()) {
-                hardware.REGISTERS[0xF] = 1;
-            } else {
-                hardware.REGISTERS[0xF] = 0;
-            }
-            hardware.REGISTERS[xRegisterIdx] = static_cast<uint8_t>(total);
+        case 0x0A:
+            op.handler = &dispatch<&Chip8::opFX0A>;
             break;
-        }
-        case 0x5: {
-            // TODO wrong?
-            int result = hardware.REGISTERS[xRegisterIdx] -
-                         hardware.REGISTERS[yRegisterIdx];
-            if (result < 0) {
-                hardware.REGISTERS[0xF] = 0;
-            } else {
-                hardware.REGISTERS[0xF] = 1;
-            }
-            hardware.REGISTERS[xRegisterIdx] -=
-                hardware.REGISTERS[yRegisterIdx];
+        case 0x15:
+            op.handler = &dispatch<&Chip8::opFX15>;
             break;
-        }
-        case 0x6: {
-            if ((hardware.REGISTERS[xRegisterIdx] & 1) == 1) {
-                hardware.REGISTERS[0xF] = 1;
-            } else {
-                hardware.REGISTERS[0xF] = 0;
-            }
-            hardware.REGISTERS[xRegisterIdx] =
-                hardware.REGISTERS[xRegisterIdx] >> 1;
+        case 0x18:
+            op.handler = &dispatch<&Chip8::opFX18>;
             break;
-        }
-        case 0x7: {
-            int result = hardware.REGISTERS[yRegisterIdx] -
-                         hardware.REGISTERS[xRegisterIdx];
-            if (result < 0) {
-                hardware.REGISTERS[0xF] = 0;
-            } else {
-                hardware.REGISTERS[0xF] = 1;
-            }
-            hardware.REGISTERS[xRegisterIdx] =
-                hardware.REGISTERS[yRegisterIdx] -
-                hardware.REGISTERS[xRegisterIdx];
+        case 0x1E:
+            op.handler = &dispatch<&Chip8::opFX1E>;
             break;
-        }
-        case 0xE: {
-            if (((hardware.REGISTERS[xRegisterIdx] >> 7) & 1) == 1) {
-                hardware.REGISTERS[0xF] = 1;
-            } else {
-                hardware.REGISTERS[0xF] = 0;
-            }
-            hardware.REGISTERS[xRegisterIdx] = hardware.REGISTERS[xRegisterIdx]
-                                               << 1;
+        case 0x29:
+            op.handler = &dispatch<&Chip8::opFX29>;
+            break;
+        case 0x33:
+            op.handler = &dispatch<&Chip8::opFX33>;
+            break;
+        case 0x55:
+            op.handler =
+                storeHandlers[static_cast<int>(quirks.indexIncrement)];
+            break;
+        case 0x65:
+            op.handler =
+                loadHandlers[static_cast<int>(quirks.indexIncrement)];
+            break;
+        default:
+            op.handler = &dispatch<&Chip8::opInvalid>;
             break;
         }
-        default: {
-            return Status::INVALID_INSTRUCTION;
+        if (quirks.superChip) {
+            op.handler = decodeSuperChip(instruction, op.handler);
         }
+        if (quirks.xoChip) {
+            op.handler = decodeXoChip(instruction, op.handler);
         }
-        hardware.PC += 2;
         break;
     }
-    case 0x9: {
-        int xRegister = hardware.REGISTERS[xRegisterIdx];
-        int yRegister = hardware.REGISTERS[yRegisterIdx];
-        if (xRegister != yRegister) {
-            hardware.PC += 4;
-        } else {
-            hardware.PC += 2;
-        }
+
+    switch ((instruction & 0xF000) >> 12) {
+    case 0x6:
+    case 0x7:
+    case 0xA:
+    case 0xC:
+        op.endsBlock = false;
         break;
-    }
-    case 0xA: {
-        hardware.I = nnn;
-        hardware.PC += 2;
+    case 0x0:
+        op.endsBlock = instruction != 0x00E0;
         break;
-    }
-    case 0xB: {
-        int registerValue = hardware.REGISTERS[0];
-        hardware.PC = nnn + registerValue;
+    case 0x8:
+        op.endsBlock = op.handler == &dispatch<&Chip8::opInvalid>;
         break;
-    }
-    case 0xC: {
-        hardware.REGISTERS[xRegisterIdx] =
-            getRandomByte() & static_cast<uint8_t>(kk);
-        hardware.PC += 2;
+    case 0xF:
+        // F000 for its second word, which is not an instruction
+        op.endsBlock = op.kk == 0x0A || op.kk == 0x33 || op.kk == 0x55 ||
+                       instruction == 0xF000 ||
+                       op.handler == &dispatch<&Chip8::opInvalid>;
+        break;
+    default:
+        op.endsBlock = true;
         break;
     }
-    case 0xD: {
-        int spriteHeight = n;
-        hardware.REGISTERS[0xF] = 0;
-        auto xRegister = hardware.REGISTERS[xRegisterIdx];
-        auto yRegister = hardware.REGISTERS[yRegisterIdx];
-        for (int row = 0; row < spriteHeight; row++) {
-            auto drawByte = hardware.MEMORY[hardware.I + row];
-            for (int col = 0; col < BITS_PER_BYTE; col++) {
-                // iterate over bits
-                bool pixelOn = drawByte & (0x80 >> col);
-                if (pixelOn) {
-                    int xPixel = (xRegister + col) % CHIP8_DISPLAY_WIDTH;
-                    int yPixel = (yRegister + row) % CHIP8_DISPLAY_HEIGHT;
-                    int byteIdx =
-                        (yPixel * CHIP8_DISPLAY_WIDTH + xPixel) / BITS_PER_BYTE;
-                    int bitIdx = 7 - ((yPixel * CHIP8_DISPLAY_WIDTH + xPixel) %
-                                      BITS_PER_BYTE);
-                    if (hardware
-                            .MEMORY[Chip8Hardware::DISPLAY_START + byteIdx] &
-                        (1 << bitIdx)) {
-                        hardware.REGISTERS[0xF] = 1;
-                    }
-                    hardware.MEMORY[Chip8Hardware::DISPLAY_START + byteIdx] ^=
-                        (1 << bitIdx);
-                }
-            }
+    // the first instruction of every loop skipIdle() recognises
+    op.mayIdle = (instruction & 0xF000) == 0x1000 ||
+                 op.handler == &dispatch<&Chip8::opFX07> ||
+                 op.handler == &dispatch<&Chip8::opFX0A>;
+    return op;
+}
+
+Chip8::Handler Chip8::decodeSuperChip(uint16_t instruction, Handler handler) {
+    if ((instruction & 0xFFF0) == 0x00C0) {
+        return &dispatch<&Chip8::op00CN>;
+    }
+    switch (instruction) {
+    case 0x00FB:
+        return &dispatch<&Chip8::op00FB>;
+    case 0x00FC:
+        return &dispatch<&Chip8::op00FC>;
+    case 0x00FD:
+        return &dispatch<&Chip8::op00FD>;
+    case 0x00FE:
+        return &dispatch<&Chip8::op00FE>;
+    case 0x00FF:
+        return &dispatch<&Chip8::op00FF>;
+    }
+    if ((instruction & 0xF000) == 0xF000) {
+        switch (instruction & 0x00FF) {
+        case 0x30:
+            return &dispatch<&Chip8::opFX30>;
+        case 0x75:
+            return &dispatch<&Chip8::opFX75>;
+        case 0x85:
+            return &dispatch<&Chip8::opFX85>;
         }
-        hardware.PC += 2;
-        break;
     }
-    case 0xE: {
-        uint8_t key = hardware.REGISTERS[xRegisterIdx] & 0xF;
-        switch (instruction & 0xFF) {
-        case 0x9E: {
-            if (((1 << key) & hardware.KEY_STATE) != 0) {
-                hardware.PC += 4;
-            } else {
-                hardware.PC += 2;
+    return handler;
+}
+
+Chip8::Handler Chip8::decodeXoChip(uint16_t instruction, Handler handler) {
+    if ((instruction & 0xFFF0) == 0x00D0) {
+        return &dispatch<&Chip8::op00DN>;
+    }
+    if ((instruction & 0xF00F) == 0x5002) {
+        return &dispatch<&Chip8::op5XY2>;
+    }
+    if ((instruction & 0xF00F) == 0x5003) {
+        return &dispatch<&Chip8::op5XY3>;
+    }
+    if ((instruction & 0xF000) == 0xF000) {
+        switch (instruction & 0x00FF) {
+        case 0x00:
+            return &dispatch<&Chip8::opF000>;
+        case 0x01:
+            return &dispatch<&Chip8::opFX01>;
+        case 0x02:
+            return &dispatch<&Chip8::opF002>;
+        case 0x3A:
+            return &dispatch<&Chip8::opFX3A>;
+        }
+    }
+    return handler;
+}
+
+Chip8::DecodedInstruction Chip8::decodeAt(uint16_t address) const {
+    const uint16_t instruction = fetch(address);
+    DecodedInstruction op = decode(instruction);
+    // the stand-ins end their block so a stop leaves PC on them
+    if (breakpoints.test(address & addressMask)) [[unlikely]] {
+        op.handler = &dispatch<&Chip8::opBreakpoint>;
+        op.endsBlock = true;
+        op.mayIdle = false;
+    } else if (!watchpoints.empty() &&
+               (instruction >> 12 == 0xD ||
+                (instruction >> 12 == 0xF &&
+                 ((instruction & 0xFF) == 0x33 ||
+                  (instruction & 0xFF) == 0x55 ||
+                  (instruction & 0xFF) == 0x65)) ||
+                op.handler == &dispatch<&Chip8::op5XY2> ||
+                op.handler == &dispatch<&Chip8::op5XY3> ||
+                op.handler == &dispatch<&Chip8::opF002>)) {
+        op.handler = &dispatch<&Chip8::opWatched>;
+        op.endsBlock = true;
+    }
+    return op;
+}
+
+int Chip8::skipIdle(const DecodedInstruction &op, int cycles) {
+#ifdef CHIP8_PROFILE
+    // the profile counts every instruction at its PC
+    return 0;
+#endif
+    if (coverage) {
+        // the fuzzer wants the loop's edges
+        return 0;
+    }
+    const uint16_t pc = hardware.PC;
+    int skipped = 0;
+    if (op.handler == &dispatch<&Chip8::opFX0A>) {
+        // no key change can arrive mid-run, so an FX0A that has nothing to
+        // latch or release now spins through the whole budget
+        if (waitingForKeyUp == (hardware.KEY_STATE != 0)) {
+            skipped = cycles;
+        }
+    } else if (op.handler == &dispatch<&Chip8::op1NNN>) {
+        // a jump to itself, the usual way to halt
+        if (op.nnn == pc) {
+            skipped = cycles;
+        }
+    } else if ((fetch(pc + 2) & 0xFF00) == (0x3000 | op.x << 8) &&
+               fetch(pc + 4) == (0x1000 | pc) &&
+               !breakpoints.test((pc + 2) & addressMask) &&
+               !breakpoints.test((pc + 4) & addressMask)) {
+        // FX07; 3XKK; 1NNN back to the FX07 spins until DELAY_TIMER == KK,
+        // and timers only move between frames. Whole trips leave PC here
+        // and VX holding the timer; a partial trip is left to run normally.
+        if (hardware.DELAY_TIMER != (fetch(pc + 2) & 0xFF)) {
+            skipped = cycles - cycles % 3;
+            if (skipped) {
+                hardware.REGISTERS[op.x] = hardware.DELAY_TIMER;
             }
-            break;
         }
-        case 0xA1: {
-            if (((1 << key) & hardware.KEY_STATE) == 0) {
-                hardware.PC += 4;
-            } else {
-                hardware.PC += 2;
+    }
+    return skipped;
+}
+
+void Chip8::invalidateDecoded(int address, int length) {
+    int end = std::min(address + length, DECODE_CACHE_LIMIT);
+    // an instruction at the odd address before the write overlaps it too
+    for (int i = (address & ~1); i < end; i += 2) {
+        int entry = i >> 1;
+        if (!decodeCache[entry].handler) {
+            // never decoded, so no block can cover it either
+            continue;
+        }
+        decodeCache[entry].handler = nullptr;
+        for (int start = std::max(0, entry - MAX_BLOCK_LENGTH + 1);
+             start <= entry; start++) {
+            if (start + blockLength[start] > entry) {
+                blockLength[start] = 0;
             }
+        }
+    }
+}
+
+void Chip8::markDisplayWritten(int address, int length) {
+    if (hardware.HIRES || quirks.xoChip) {
+        // those displays live outside MEMORY
+        return;
+    }
+    int begin = std::max(address, Chip8Hardware::DISPLAY_START);
+    int end = std::min(address + length, Chip8Hardware::DISPLAY_START +
+                                             Chip8Hardware::DISPLAY_SIZE);
+    for (int i = begin; i < end; i++) {
+        dirtyRows |= 1u << ((i - Chip8Hardware::DISPLAY_START) /
+                            DISPLAY_ROW_BYTES);
+    }
+}
+
+int Chip8::compileBlock(int entry) {
+    int length = 0;
+    while (length < MAX_BLOCK_LENGTH && entry + length < DECODE_CACHE_SIZE) {
+        DecodedInstruction &op = decodeCache[entry + length];
+        if (!op.handler) {
+            op = decodeAt((entry + length) << 1);
+        }
+        length++;
+        if (op.endsBlock) {
             break;
         }
+    }
+    blockLength[entry] = length;
+    return length;
+}
+
+Chip8::Status Chip8::step() {
+    Status status = execute();
+    return status == Status::DISPLAY_WAIT ? Status::OK : status;
+}
+
+Chip8::Status Chip8::execute() {
+    const uint16_t pc = hardware.PC;
+    PROFILE(profiler.onInstruction(pc, fetch(pc)));
+    if (coverage) [[unlikely]] {
+        recordEdge(pc);
+    }
+    blockEntry = pc;
+    Status status;
+    if ((pc & 1) || pc >= DECODE_CACHE_LIMIT) [[unlikely]] {
+        // odd or display-area PCs are rare and never cached
+        const DecodedInstruction op = decodeAt(pc);
+        status = op.handler(*this, op);
+    } else {
+        DecodedInstruction &op = decodeCache[pc >> 1];
+        if (!op.handler) [[unlikely]] {
+            op = decodeAt(pc);
         }
-        break;
+        status = op.handler(*this, op);
     }
-    case 0xF:
-        switch (instruction & 0xFF) {
-        case 0x07: {
-            hardware.REGISTERS[xRegisterIdx] = hardware.DELAY_TIMER;
-            hardware.PC += 2;
-            break;
+    cycleCount += status != Status::BREAKPOINT;
+    return status;
+}
+
+Chip8::Status Chip8::runCycles(int cycles) {
+    if (!conditions.empty()) [[unlikely]] {
+        return runCyclesChecked(cycles);
+    }
+    while (cycles > 0) {
+        const uint16_t pc = hardware.PC;
+        if ((pc & 1) || pc >= DECODE_CACHE_LIMIT) [[unlikely]] {
+            cycles--;
+            Status status = execute();
+            if (status != Status::OK) {
+                return status == Status::DISPLAY_WAIT ? Status::OK : status;
+            }
+            continue;
+        }
+
+        const int entry = pc >> 1;
+        int length = blockLength[entry];
+        if (!length) [[unlikely]] {
+            length = compileBlock(entry);
         }
-        case 0x0A: {
-            static bool waitingForKeyUp = false;
-            static uint8_t keyPressed = 0;
-
-            if (!waitingForKeyUp && hardware.KEY_STATE) {
-                keyPressed = std::countr_zero(hardware.KEY_STATE);
-                waitingForKeyUp = true;
-            } else if (waitingForKeyUp && !hardware.KEY_STATE) {
-                waitingForKeyUp = false;
-                hardware.REGISTERS[xRegisterIdx] = keyPressed;
-                hardware.PC += 2;
+        if (decodeCache[entry].mayIdle) [[unlikely]] {
+            const int skipped = skipIdle(decodeCache[entry], cycles);
+            cycles -= skipped;
+            cycleCount += skipped;
+            if (cycles == 0) {
+                break;
             }
-            break;
         }
-        case 0x15: {
-            hardware.DELAY_TIMER = hardware.REGISTERS[xRegisterIdx];
-            hardware.PC += 2;
-            break;
+        // every instruction but the last falls through to the next entry,
+        // so a partial run is still exact when the budget ends mid-block
+        const int count = std::min(length, cycles);
+        const DecodedInstruction *ops = &decodeCache[entry];
+        if (coverage) [[unlikely]] {
+            recordEdge(pc);
         }
-        case 0x18: {
-            hardware.SOUND_TIMER = hardware.REGISTERS[xRegisterIdx];
-            hardware.PC += 2;
-            break;
+        blockEntry = pc;
+        for (int i = 0; i < count; i++) {
+            PROFILE(profiler.onInstruction(hardware.PC, fetch(hardware.PC)));
+            Status status = ops[i].handler(*this, ops[i]);
+            if (status != Status::OK) [[unlikely]] {
+                cycleCount += i + (status != Status::BREAKPOINT);
+                // a display-wait draw ends the run like vblank did
+                return status == Status::DISPLAY_WAIT ? Status::OK : status;
+            }
         }
-        case 0x1E: {
-            hardware.I += hardware.REGISTERS[xRegisterIdx];
-            hardware.PC += 2;
-            break;
+        cycles -= count;
+        cycleCount += count;
+    }
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op00E0(const DecodedInstruction &) {
+    clearDisplay();
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op00EE(const DecodedInstruction &) {
+    const Status status = returnFromSubroutine();
+    PROFILE(profileStack());
+    return status;
+}
+
+Chip8::Status Chip8::op00CN(const DecodedInstruction &op) {
+    scroll(op.n, 0);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op00DN(const DecodedInstruction &op) {
+    scroll(-op.n, 0);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op00FB(const DecodedInstruction &) {
+    scroll(0, SCROLL_COLUMNS);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op00FC(const DecodedInstruction &) {
+    scroll(0, -SCROLL_COLUMNS);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op00FD(const DecodedInstruction &) {
+    // PC stays put, so the program stays exited
+    return Status::PROGRAM_EXITED;
+}
+
+Chip8::Status Chip8::op00FE(const DecodedInstruction &) {
+    setHires(false);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op00FF(const DecodedInstruction &) {
+    setHires(true);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op1NNN(const DecodedInstruction &op) {
+    hardware.PC = op.nnn;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op2NNN(const DecodedInstruction &op) {
+    const Status status = callSubroutine(op.nnn);
+    PROFILE(profileStack());
+    return status;
+}
+
+template <bool LongSkip>
+Chip8::Status Chip8::op3XKK(const DecodedInstruction &op) {
+    if (op.kk == hardware.REGISTERS[op.x]) {
+        skipNext<LongSkip>();
+    } else {
+        hardware.PC += 2;
+    }
+    return Status::OK;
+}
+
+template <bool LongSkip>
+Chip8::Status Chip8::op4XKK(const DecodedInstruction &op) {
+    if (op.kk != hardware.REGISTERS[op.x]) {
+        skipNext<LongSkip>();
+    } else {
+        hardware.PC += 2;
+    }
+    return Status::OK;
+}
+
+template <bool LongSkip>
+Chip8::Status Chip8::op5XY0(const DecodedInstruction &op) {
+    if (hardware.REGISTERS[op.x] == hardware.REGISTERS[op.y]) {
+        skipNext<LongSkip>();
+    } else {
+        hardware.PC += 2;
+    }
+    return Status::OK;
+}
+
+// VX to VY inclusive, in either direction; I stays put
+Chip8::Status Chip8::op5XY2(const DecodedInstruction &op) {
+    const int count = std::abs(op.x - op.y) + 1;
+    if (!indexFits(count)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    const int direction = op.x <= op.y ? 1 : -1;
+    for (int i = 0; i < count; i++) {
+        hardware.MEMORY[hardware.I + i] =
+            hardware.REGISTERS[op.x + i * direction];
+    }
+    invalidateDecoded(hardware.I, count);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op5XY3(const DecodedInstruction &op) {
+    const int count = std::abs(op.x - op.y) + 1;
+    if (!indexFits(count)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    const int direction = op.x <= op.y ? 1 : -1;
+    for (int i = 0; i < count; i++) {
+        hardware.REGISTERS[op.x + i * direction] =
+            hardware.MEMORY[hardware.I + i];
+    }
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op6XKK(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] = op.kk;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op7XKK(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] += op.kk;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op8XY0(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] = hardware.REGISTERS[op.y];
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <bool ResetVF>
+Chip8::Status Chip8::op8XY1(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] |= hardware.REGISTERS[op.y];
+    if constexpr (ResetVF) {
+        hardware.REGISTERS[0xF] = 0;
+    }
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <bool ResetVF>
+Chip8::Status Chip8::op8XY2(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] &= hardware.REGISTERS[op.y];
+    if constexpr (ResetVF) {
+        hardware.REGISTERS[0xF] = 0;
+    }
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <bool ResetVF>
+Chip8::Status Chip8::op8XY3(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] ^= hardware.REGISTERS[op.y];
+    if constexpr (ResetVF) {
+        hardware.REGISTERS[0xF] = 0;
+    }
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op8XY4(const DecodedInstruction &op) {
+    int total = hardware.REGISTERS[op.x] + hardware.REGISTERS[op.y];
+    if (total > std::numeric_limits<uint8_t>::max()) {
+        hardware.REGISTERS[0xF] = 1;
+    } else {
+        hardware.REGISTERS[0xF] = 0;
+    }
+    hardware.REGISTERS[op.x] = static_cast<uint8_t>(total);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op8XY5(const DecodedInstruction &op) {
+    // TODO wrong?
+    int result = hardware.REGISTERS[op.x] - hardware.REGISTERS[op.y];
+    if (result < 0) {
+        hardware.REGISTERS[0xF] = 0;
+    } else {
+        hardware.REGISTERS[0xF] = 1;
+    }
+    hardware.REGISTERS[op.x] -= hardware.REGISTERS[op.y];
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <bool UseVY>
+Chip8::Status Chip8::op8XY6(const DecodedInstruction &op) {
+    if constexpr (UseVY) {
+        hardware.REGISTERS[op.x] = hardware.REGISTERS[op.y];
+    }
+    if ((hardware.REGISTERS[op.x] & 1) == 1) {
+        hardware.REGISTERS[0xF] = 1;
+    } else {
+        hardware.REGISTERS[0xF] = 0;
+    }
+    hardware.REGISTERS[op.x] = hardware.REGISTERS[op.x] >> 1;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::op8XY7(const DecodedInstruction &op) {
+    int result = hardware.REGISTERS[op.y] - hardware.REGISTERS[op.x];
+    if (result < 0) {
+        hardware.REGISTERS[0xF] = 0;
+    } else {
+        hardware.REGISTERS[0xF] = 1;
+    }
+    hardware.REGISTERS[op.x] =
+        hardware.REGISTERS[op.y] - hardware.REGISTERS[op.x];
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <bool UseVY>
+Chip8::Status Chip8::op8XYE(const DecodedInstruction &op) {
+    if constexpr (UseVY) {
+        hardware.REGISTERS[op.x] = hardware.REGISTERS[op.y];
+    }
+    if (((hardware.REGISTERS[op.x] >> 7) & 1) == 1) {
+        hardware.REGISTERS[0xF] = 1;
+    } else {
+        hardware.REGISTERS[0xF] = 0;
+    }
+    hardware.REGISTERS[op.x] = hardware.REGISTERS[op.x] << 1;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <bool LongSkip>
+Chip8::Status Chip8::op9XY0(const DecodedInstruction &op) {
+    if (hardware.REGISTERS[op.x] != hardware.REGISTERS[op.y]) {
+        skipNext<LongSkip>();
+    } else {
+        hardware.PC += 2;
+    }
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opANNN(const DecodedInstruction &op) {
+    hardware.I = op.nnn;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <bool UseVX>
+Chip8::Status Chip8::opBNNN(const DecodedInstruction &op) {
+    hardware.PC = op.nnn + hardware.REGISTERS[UseVX ? op.x : 0];
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opCXKK(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] = getRandomByte() & op.kk;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+namespace {
+template <typename Row> Row rotateRight(Row bits, int shift) {
+    if constexpr (std::is_same_v<Row, uint64_t>) {
+        return std::rotr(bits, shift);
+    } else {
+        constexpr int width = sizeof(Row) * BITS_PER_BYTE;
+        return shift ? bits >> shift | bits << (width - shift) : bits;
+    }
+}
+} // namespace
+
+template <int Width, int Height, bool Clip, int SpriteBytes>
+bool Chip8::blitSprite(std::span<uint8_t> display,
+                       std::span<const uint8_t> sprite, int xPosition,
+                       int yPosition) {
+    using Row = DisplayRow<Width>;
+    constexpr int maxHeight =
+        SpriteBytes == 1 ? MAX_SPRITE_HEIGHT : BIG_SPRITE_SIZE;
+    constexpr int spriteWidth = SpriteBytes * BITS_PER_BYTE;
+    assert(sprite.size() <= maxHeight * SpriteBytes);
+    const int shift = xPosition % Width;
+    const int top = yPosition % Height;
+    int height = sprite.size() / SpriteBytes;
+    if constexpr (Clip) {
+        height = std::min(height, Height - top);
+    }
+
+    // gather the covered rows first so the blit below is a straight run
+    // over arrays that the compiler can keep in vector registers
+    Row rows[maxHeight];
+    for (int row = 0; row < height; row++) {
+        rows[row] = loadDisplayRow<Width>(display, (top + row) % Height);
+    }
+    Row hit = 0;
+    for (int row = 0; row < height; row++) {
+        // the sprite row lands in the top bits; the rotate wraps columns
+        // round, the plain shift drops them off the right edge
+        Row bits = 0;
+        for (int byte = 0; byte < SpriteBytes; byte++) {
+            bits = bits << BITS_PER_BYTE | sprite[row * SpriteBytes + byte];
         }
-        case 0x29: {
-            hardware.I = Chip8Hardware::FONT_SET_START +
-                         (hardware.REGISTERS[xRegisterIdx] *
-                          Chip8Sprites::SPRITE_HEIGHT);
-            hardware.PC += 2;
-            break;
+        bits <<= Width - spriteWidth;
+        const Row mask = Clip ? bits >> shift : rotateRight(bits, shift);
+        hit |= rows[row] & mask;
+        rows[row] ^= mask;
+    }
+    for (int row = 0; row < height; row++) {
+        storeDisplayRow<Width>(display, (top + row) % Height, rows[row]);
+    }
+    return hit != 0;
+}
+
+template bool Chip8::blitSprite<Chip8::CHIP8_DISPLAY_WIDTH,
+                                Chip8::CHIP8_DISPLAY_HEIGHT, false, 1>(
+    std::span<uint8_t> display, std::span<const uint8_t> sprite,
+    int xPosition, int yPosition);
+template bool Chip8::blitSprite<Chip8::CHIP8_DISPLAY_WIDTH,
+                                Chip8::CHIP8_DISPLAY_HEIGHT, true, 1>(
+    std::span<uint8_t> display, std::span<const uint8_t> sprite,
+    int xPosition, int yPosition);
+
+template <int Width, int Height>
+void Chip8::scrollDisplay(std::span<uint8_t> display, int down, int right) {
+    constexpr int rowBytes = Width / BITS_PER_BYTE;
+    // rows are contiguous, so scrolling up or down is one move
+    if (down > 0) {
+        memmove(&display[down * rowBytes], &display[0],
+                (Height - down) * rowBytes);
+        memset(&display[0], 0, down * rowBytes);
+    } else if (down < 0) {
+        memmove(&display[0], &display[-down * rowBytes],
+                (Height + down) * rowBytes);
+        memset(&display[(Height + down) * rowBytes], 0, -down * rowBytes);
+    }
+    if (right) {
+        for (int row = 0; row < Height; row++) {
+            DisplayRow<Width> bits = loadDisplayRow<Width>(display, row);
+            bits = right > 0 ? bits >> right : bits << -right;
+            storeDisplayRow<Width>(display, row, bits);
         }
-        case 0x33: {
-            int value = hardware.REGISTERS[xRegisterIdx];
-            int hundreds = value / 100;
-            int tens = (value / 10) % 10;
-            int ones = value % 10;
-            hardware.MEMORY[hardware.I] = hundreds;
-            hardware.MEMORY[hardware.I + 1] = tens;
-            hardware.MEMORY[hardware.I + 2] = ones;
-            hardware.PC += 2;
-            break;
+    }
+}
+
+void Chip8::scroll(int down, int right) {
+    // distances are in pixels of the current mode, as modern SUPER-CHIP
+    // interpreters do, rather than always in hi-res pixels
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(hardware.PLANES >> plane & 1)) {
+            continue;
         }
-        case 0x55: {
-            // TODO conflicting specs here
-            memcpy(&hardware.MEMORY[hardware.I], &hardware.REGISTERS[0],
-                   xRegisterIdx + 1);
-            hardware.PC += 2;
-            break;
+        if (hardware.HIRES) {
+            scrollDisplay<SCHIP_DISPLAY_WIDTH, SCHIP_DISPLAY_HEIGHT>(
+                displayBytes(plane), down, right);
+        } else {
+            scrollDisplay<CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT>(
+                displayBytes(plane), down, right);
+        }
+    }
+    dirtyRows = ALL_ROWS_DIRTY;
+}
+
+template <bool Clip, bool Wait>
+Chip8::Status Chip8::opDXYN(const DecodedInstruction &op) {
+    if (!indexFits(op.n)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    hardware.REGISTERS[0xF] = 0;
+    auto xRegister = hardware.REGISTERS[op.x];
+    auto yRegister = hardware.REGISTERS[op.y];
+    auto display = std::span(hardware.MEMORY)
+                       .template subspan<Chip8Hardware::DISPLAY_START,
+                                         Chip8Hardware::DISPLAY_SIZE>();
+    if (drawSprite<Clip>(display,
+                         std::span(&hardware.MEMORY[hardware.I], op.n),
+                         xRegister, yRegister)) {
+        hardware.REGISTERS[0xF] = 1;
+    }
+    PROFILE(profiler.onDraw(hardware.REGISTERS[0xF]));
+    // rows yRegister..yRegister + N - 1, wrapping at the bottom unless
+    // clipped, where the shift drops them instead
+    const uint32_t rows = (1u << op.n) - 1;
+    const int top = yRegister % CHIP8_DISPLAY_HEIGHT;
+    dirtyRows |= Clip ? rows << top : std::rotl(rows, top);
+    hardware.PC += 2;
+    return Wait ? Status::DISPLAY_WAIT : Status::OK;
+}
+
+template <bool Clip>
+bool Chip8::blitActive(std::span<uint8_t> display,
+                       std::span<const uint8_t> sprite, bool big,
+                       int xPosition, int yPosition) {
+    if (hardware.HIRES) {
+        return big ? blitSprite<SCHIP_DISPLAY_WIDTH, SCHIP_DISPLAY_HEIGHT,
+                                Clip, 2>(display, sprite, xPosition, yPosition)
+                   : blitSprite<SCHIP_DISPLAY_WIDTH, SCHIP_DISPLAY_HEIGHT,
+                                Clip, 1>(display, sprite, xPosition, yPosition);
+    }
+    return big ? blitSprite<CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT, Clip,
+                            2>(display, sprite, xPosition, yPosition)
+               : blitSprite<CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT, Clip,
+                            1>(display, sprite, xPosition, yPosition);
+}
+
+template <bool Clip, bool Wait>
+Chip8::Status Chip8::opDXYNSuper(const DecodedInstruction &op) {
+    // DXY0 draws a 16x16 sprite of two bytes per row
+    const int height = op.n ? op.n : BIG_SPRITE_SIZE;
+    const int spriteBytes = op.n ? op.n : 2 * BIG_SPRITE_SIZE;
+    // each selected plane takes the next sprite's worth of bytes
+    const int planes = std::popcount(hardware.PLANES);
+    if (!indexFits(spriteBytes * planes)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    hardware.REGISTERS[0xF] = 0;
+    auto xRegister = hardware.REGISTERS[op.x];
+    auto yRegister = hardware.REGISTERS[op.y];
+    int offset = hardware.I;
+    bool hit = false;
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(hardware.PLANES >> plane & 1)) {
+            continue;
         }
-        case 0x65: {
-            // TODO conflicting specs here
-            memcpy(&hardware.REGISTERS[0], &hardware.MEMORY[hardware.I],
-                   xRegisterIdx + 1);
-            hardware.PC += 2;
+        auto sprite =
+            std::span<const uint8_t>(&hardware.MEMORY[offset], spriteBytes);
+        hit |= blitActive<Clip>(displayBytes(plane), sprite, !op.n, xRegister,
+                                yRegister);
+        offset += spriteBytes;
+    }
+    hardware.REGISTERS[0xF] = hit;
+    PROFILE(profiler.onDraw(hit));
+    // a dirty bit covers two rows in hi-res
+    const int displayHeight = getDisplayHeight();
+    const int rowsPerBit = displayHeight / CHIP8_DISPLAY_HEIGHT;
+    const int top = yRegister % displayHeight;
+    for (int row = top; row < top + height; row++) {
+        if (Clip && row >= displayHeight) {
             break;
         }
-        default: {
-            return Status::INVALID_INSTRUCTION;
+        dirtyRows |= 1u << (row % displayHeight / rowsPerBit);
+    }
+    hardware.PC += 2;
+    return Wait ? Status::DISPLAY_WAIT : Status::OK;
+}
+
+template <bool LongSkip>
+Chip8::Status Chip8::opEX9E(const DecodedInstruction &op) {
+    uint8_t key = hardware.REGISTERS[op.x] & 0xF;
+    if (((1 << key) & hardware.KEY_STATE) != 0) {
+        skipNext<LongSkip>();
+    } else {
+        hardware.PC += 2;
+    }
+    return Status::OK;
+}
+
+template <bool LongSkip>
+Chip8::Status Chip8::opEXA1(const DecodedInstruction &op) {
+    uint8_t key = hardware.REGISTERS[op.x] & 0xF;
+    if (((1 << key) & hardware.KEY_STATE) == 0) {
+        skipNext<LongSkip>();
+    } else {
+        hardware.PC += 2;
+    }
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opF000(const DecodedInstruction &) {
+    hardware.I = fetch(hardware.PC + 2);
+    hardware.PC += 4;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX01(const DecodedInstruction &op) {
+    hardware.PLANES = op.x;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opF002(const DecodedInstruction &) {
+    if (!indexFits(Chip8Hardware::AUDIO_PATTERN_SIZE)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    memcpy(hardware.AUDIO_PATTERN.data(), &hardware.MEMORY[hardware.I],
+           Chip8Hardware::AUDIO_PATTERN_SIZE);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX07(const DecodedInstruction &op) {
+    hardware.REGISTERS[op.x] = hardware.DELAY_TIMER;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX0A(const DecodedInstruction &op) {
+    if (!waitingForKeyUp && hardware.KEY_STATE) {
+        keyPressed = std::countr_zero(hardware.KEY_STATE);
+        waitingForKeyUp = true;
+    } else if (waitingForKeyUp && !hardware.KEY_STATE) {
+        waitingForKeyUp = false;
+        hardware.REGISTERS[op.x] = keyPressed;
+        hardware.PC += 2;
+        return Status::OK;
+    }
+    PROFILE(profiler.onKeyWait());
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX15(const DecodedInstruction &op) {
+    hardware.DELAY_TIMER = hardware.REGISTERS[op.x];
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX18(const DecodedInstruction &op) {
+    hardware.SOUND_TIMER = hardware.REGISTERS[op.x];
+    trackSound(currentCycle());
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX1E(const DecodedInstruction &op) {
+    hardware.I += hardware.REGISTERS[op.x];
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX29(const DecodedInstruction &op) {
+    hardware.I = Chip8Hardware::FONT_SET_START +
+                 (hardware.REGISTERS[op.x] * Chip8Sprites::SPRITE_HEIGHT);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX30(const DecodedInstruction &op) {
+    // only digits have big glyphs; keep higher values inside the font
+    hardware.I = Chip8Hardware::BIG_FONT_SET_START +
+                 (hardware.REGISTERS[op.x] % 10) *
+                     Chip8Sprites::BIG_SPRITE_HEIGHT;
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX33(const DecodedInstruction &op) {
+    if (!indexFits(3)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    int value = hardware.REGISTERS[op.x];
+    int hundreds = value / 100;
+    int tens = (value / 10) % 10;
+    int ones = value % 10;
+    hardware.MEMORY[hardware.I] = hundreds;
+    hardware.MEMORY[hardware.I + 1] = tens;
+    hardware.MEMORY[hardware.I + 2] = ones;
+    invalidateDecoded(hardware.I, 3);
+    markDisplayWritten(hardware.I, 3);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <Chip8::IndexIncrement Increment>
+Chip8::Status Chip8::opFX55(const DecodedInstruction &op) {
+    if (!indexFits(op.x + 1)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    memcpy(&hardware.MEMORY[hardware.I], &hardware.REGISTERS[0], op.x + 1);
+    invalidateDecoded(hardware.I, op.x + 1);
+    markDisplayWritten(hardware.I, op.x + 1);
+    advanceIndex<Increment>(op.x);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+template <Chip8::IndexIncrement Increment>
+Chip8::Status Chip8::opFX65(const DecodedInstruction &op) {
+    if (!indexFits(op.x + 1)) [[unlikely]] {
+        return Status::MEMORY_OUT_OF_BOUNDS;
+    }
+    memcpy(&hardware.REGISTERS[0], &hardware.MEMORY[hardware.I], op.x + 1);
+    advanceIndex<Increment>(op.x);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX3A(const DecodedInstruction &op) {
+    hardware.PITCH = hardware.REGISTERS[op.x];
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX75(const DecodedInstruction &op) {
+    memcpy(hardware.RPL_FLAGS, hardware.REGISTERS, op.x + 1);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opFX85(const DecodedInstruction &op) {
+    memcpy(hardware.REGISTERS, hardware.RPL_FLAGS, op.x + 1);
+    hardware.PC += 2;
+    return Status::OK;
+}
+
+Chip8::Status Chip8::opInvalid(const DecodedInstruction &) {
+    return Status::INVALID_INSTRUCTION;
+}
+
+Chip8::Status Chip8::opBreakpoint(const DecodedInstruction &) {
+    if (resumePc == hardware.PC) {
+        return runResumed();
+    }
+    debugEvent = {DebugEvent::Kind::BREAKPOINT, hardware.PC, hardware.PC};
+    return Status::BREAKPOINT;
+}
+
+Chip8::Status Chip8::opWatched(const DecodedInstruction &) {
+    if (resumePc == hardware.PC) {
+        return runResumed();
+    }
+    const uint16_t instruction = fetch(hardware.PC);
+    const int x = (instruction & 0x0F00) >> 8;
+    const int y = (instruction & 0x00F0) >> 4;
+    WatchKind access = WatchKind::READ;
+    int length = x + 1;
+    if (instruction >> 12 == 0xD) {
+        const int n = instruction & 0xF;
+        const bool big = quirks.superChip || quirks.xoChip;
+        length = (n ? n : big ? 2 * BIG_SPRITE_SIZE : 0) *
+                 std::popcount(hardware.PLANES);
+    } else if (instruction >> 12 == 0x5) {
+        // 5XY2 writes VX to VY, 5XY3 reads them
+        access = (instruction & 0xF) == 2 ? WatchKind::WRITE : WatchKind::READ;
+        length = std::abs(x - y) + 1;
+    } else if ((instruction & 0xFF) == 0x02) {
+        length = Chip8Hardware::AUDIO_PATTERN_SIZE;
+    } else if ((instruction & 0xFF) == 0x33) {
+        access = WatchKind::WRITE;
+        length = 3;
+    } else if ((instruction & 0xFF) == 0x55) {
+        access = WatchKind::WRITE;
+    }
+    for (const auto &watch : watchpoints) {
+        const int begin = std::max<int>(watch.address, hardware.I);
+        const int end =
+            std::min<int>(watch.address + watch.length, hardware.I + length);
+        if (begin < end && (static_cast<int>(watch.kind) &
+                            static_cast<int>(access))) {
+            debugEvent = {DebugEvent::Kind::WATCHPOINT, hardware.PC,
+                          static_cast<uint16_t>(begin)};
+            return Status::BREAKPOINT;
+        }
+    }
+    const DecodedInstruction real = decode(instruction);
+    return real.handler(*this, real);
+}
+
+Chip8::Status Chip8::runResumed() {
+    resumePc = -1;
+    const DecodedInstruction real = decode(fetch(hardware.PC));
+    return real.handler(*this, real);
+}
+
+Chip8::Status Chip8::runCyclesChecked(int cycles) {
+    for (; cycles > 0; cycles--) {
+        Status status = execute();
+        if (status != Status::OK) {
+            return status == Status::DISPLAY_WAIT ? Status::OK : status;
         }
+        for (std::size_t i = 0; i < conditions.size(); i++) {
+            const uint32_t bit = 1u << i;
+            const bool held = conditionsTrue & bit;
+            if (conditionHolds(conditions[i])) {
+                conditionsTrue |= bit;
+                if (!held) {
+                    debugEvent = {DebugEvent::Kind::CONDITION, hardware.PC,
+                                  static_cast<uint16_t>(i)};
+                    return Status::BREAKPOINT;
+                }
+            } else {
+                conditionsTrue &= ~bit;
+            }
         }
+    }
+    return Status::OK;
+}
+
+bool Chip8::conditionHolds(const Condition &condition) const {
+    int value = 0;
+    switch (condition.operand) {
+    case ConditionOperand::REGISTER:
+        value = hardware.REGISTERS[condition.x & 0xF];
+        break;
+    case ConditionOperand::INDEX:
+        value = hardware.I;
+        break;
+    case ConditionOperand::DELAY_TIMER:
+        value = hardware.DELAY_TIMER;
+        break;
+    case ConditionOperand::SOUND_TIMER:
+        value = hardware.SOUND_TIMER;
         break;
-    default: {
-        return Status::INVALID_INSTRUCTION;
     }
+    switch (condition.comparison) {
+    case Comparison::EQUAL:
+        return value == condition.value;
+    case Comparison::NOT_EQUAL:
+        return value != condition.value;
+    case Comparison::LESS:
+        return value < condition.value;
+    case Comparison::LESS_EQUAL:
+        return value <= condition.value;
+    case Comparison::GREATER:
+        return value > condition.value;
+    case Comparison::GREATER_EQUAL:
+        return value >= condition.value;
     }
-    return Status::OK;
+    return false;
+}
+
+void Chip8::addBreakpoint(uint16_t address) {
+    address &= addressMask;
+    breakpoints.set(address);
+    invalidateDecoded(address, 1);
+}
+
+void Chip8::removeBreakpoint(uint16_t address) {
+    address &= addressMask;
+    breakpoints.reset(address);
+    invalidateDecoded(address, 1);
+}
+
+void Chip8::addWatchpoint(uint16_t address, uint16_t length, WatchKind kind) {
+    // every memory access has to be redecoded as a checked one
+    if (watchpoints.empty()) {
+        invalidateAllDecoded();
+    }
+    watchpoints.push_back({address, length, kind});
+}
+
+bool Chip8::addCondition(const Condition &condition) {
+    if (conditions.size() >= MAX_CONDITIONS) {
+        return false;
+    }
+    // one that already holds waits until it stops holding
+    if (conditionHolds(condition)) {
+        conditionsTrue |= 1u << conditions.size();
+    }
+    conditions.push_back(condition);
+    return true;
+}
+
+void Chip8::clearDebugPoints() {
+    breakpoints.reset();
+    watchpoints.clear();
+    conditions.clear();
+    conditionsTrue = 0;
+    resumePc = -1;
+    invalidateAllDecoded();
+}
+
+void Chip8::resume() {
+    // only a stand-in consumes it, so only arm it under one
+    const Handler handler = decodeAt(hardware.PC).handler;
+    if (handler == &dispatch<&Chip8::opBreakpoint> ||
+        handler == &dispatch<&Chip8::opWatched>) {
+        resumePc = hardware.PC;
+    }
+}
+
+Chip8::Status Chip8::runUntil(uint16_t address, int frames,
+                              int instructionsPerFrame) {
+    const bool planted = breakpoints.test(address & addressMask);
+    if (!planted) {
+        addBreakpoint(address);
+    }
+    resume();
+    Status status = Status::OK;
+    for (int frame = 0; frame < frames && status == Status::OK; frame++) {
+        status = runFrame(instructionsPerFrame);
+    }
+    if (!planted) {
+        removeBreakpoint(address);
+    }
+    return status;
+}
+
+Chip8::CpuState Chip8::getState() const {
+    CpuState state;
+    state.pc = hardware.PC;
+    state.sp = hardware.SP;
+    state.i = hardware.I;
+    std::copy(std::begin(hardware.REGISTERS), std::end(hardware.REGISTERS),
+              state.registers.begin());
+    state.delayTimer = hardware.DELAY_TIMER;
+    state.soundTimer = hardware.SOUND_TIMER;
+    state.keyState = hardware.KEY_STATE;
+    state.hires = hardware.HIRES;
+    for (int i = 0; i + 1 < std::min<int>(hardware.SP,
+                                          Chip8Hardware::STACK_SIZE);
+         i += 2) {
+        state.callStack.push_back(hardware.STACK[i] << 8 |
+                                  hardware.STACK[i + 1]);
+    }
+    return state;
+}
+
+std::string Chip8::CpuState::toString() const {
+    std::stringstream out;
+    out << "PC: " << std::hex << pc << "\n";
+    out << "SP: " << std::hex << sp << "\n";
+    for (int i = 0; i < Chip8Hardware::REGISTER_COUNT; i++) {
+        out << "V[" << std::hex << i << "]=" << std::hex
+            << static_cast<int>(registers[i]) << " ";
+    }
+    out << "\nI: " << std::hex << i << "\n";
+    out << "DT: " << std::hex << static_cast<int>(delayTimer) << "\n";
+    out << "ST: " << std::hex << static_cast<int>(soundTimer) << "\n";
+    return out.str();
+}
+
+Chip8::Status Chip8::runFrame(int instructionsPerFrame) {
+    Status status = runCycles(instructionsPerFrame);
+    decrementTimers();
+    return status;
 }
 
 void Chip8::decrementTimers() {
@@ -371,5 +1586,20 @@ void Chip8::decrementTimers() {
     }
     if (hardware.SOUND_TIMER > 0) {
         hardware.SOUND_TIMER--;
+        trackSound(cycleCount);
+    }
+}
+
+void Chip8::trackSound(uint64_t cycle) {
+    const bool on = hardware.SOUND_TIMER > 0;
+    if (on == soundOn) {
+        return;
+    }
+    soundOn = on;
+    // a full log keeps its newest slot current, so the final state is right
+    // even when the edges in between are lost
+    if (soundEventCount == MAX_SOUND_EVENTS) {
+        soundEventCount--;
     }
+    soundEvents[soundEventCount++] = {cycle, on};
 }
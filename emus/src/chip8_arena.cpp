@@ -0,0 +1,40 @@
+#include "chip8_arena.hpp"
+#include <cassert>
+#include <new>
+
+Chip8Arena::Chip8Arena(const Chip8 &golden, int capacity)
+    : slots(std::make_unique_for_overwrite<Slot[]>(capacity + 1)),
+      slotCount(capacity + 1) {
+    new (slots[0].bytes) Chip8(golden);
+    constructed = 1;
+    released.reserve(capacity);
+}
+
+Chip8Arena::~Chip8Arena() {
+    for (int index = 0; index < constructed; index++) {
+        slot(index)->~Chip8();
+    }
+}
+
+Chip8 *Chip8Arena::acquire(std::optional<uint32_t> seed) {
+    Chip8 *emulator;
+    if (!released.empty()) {
+        emulator = released.back();
+        released.pop_back();
+        emulator->cloneFrom(golden());
+    } else if (constructed < slotCount) {
+        emulator = new (slots[constructed].bytes) Chip8(golden());
+        constructed++;
+    } else {
+        return nullptr;
+    }
+    if (seed) {
+        emulator->reseed(*seed);
+    }
+    return emulator;
+}
+
+void Chip8Arena::release(Chip8 *emulator) {
+    assert(emulator > slot(0) && emulator < slot(0) + slotCount);
+    released.push_back(emulator);
+}
@@ -0,0 +1,481 @@
+#include "chip8_capture.hpp"
+#include <algorithm>
+#include <stop_token>
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t CAPTURE_MAGIC = 0x43563843; // "C8VC" little-endian
+constexpr uint32_t CAPTURE_VERSION = 1;
+
+struct CaptureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t framesPerSecond;
+    uint32_t reserved;
+};
+
+// Record tags. A frame record is followed by tokens covering the frame's
+// bytes: t < 0x80 keeps t + 1 bytes, t >= 0x80 XORs the next t - 0x7F.
+enum Record : uint8_t {
+    // followed by n: the previous frame n + 1 more times
+    REPEAT = 0,
+    LOW_RES_FRAME = 1,
+    HIGH_RES_FRAME = 2,
+};
+constexpr int MAX_RUN = 0x80;
+constexpr int MAX_REPEATS = 0x100;
+
+constexpr std::size_t WRITE_CHUNK = 64 << 10;
+
+void writeFrameTokens(std::span<const uint8_t> delta,
+                      std::vector<uint8_t> &out) {
+    std::size_t i = 0;
+    while (i < delta.size()) {
+        std::size_t run = 0;
+        while (i + run < delta.size() && run < MAX_RUN && !delta[i + run]) {
+            run++;
+        }
+        if (run) {
+            out.push_back(run - 1);
+            i += run;
+            continue;
+        }
+        // a single unchanged byte between changes is cheaper kept literal
+        std::size_t literal = 0;
+        while (i + literal < delta.size() && literal < MAX_RUN &&
+               (delta[i + literal] ||
+                (i + literal + 1 < delta.size() && delta[i + literal + 1]))) {
+            literal++;
+        }
+        out.push_back(0x7F + literal);
+        out.insert(out.end(), &delta[i], &delta[i] + literal);
+        i += literal;
+    }
+}
+
+// every frame at the capture's largest size times `scale`
+struct ExportGeometry {
+    int width = 0;
+    int height = 0;
+    int scale = 1;
+
+    // the pixel at (x, y) in the largest resolution, before scaling
+    static bool pixel(const Chip8CaptureDecoder::Frame &frame, int x, int y,
+                      const ExportGeometry &geometry) {
+        const int sourceScale = geometry.width / frame.width;
+        const int sourceX = x / sourceScale;
+        const int sourceY = y / sourceScale;
+        const int bit = sourceY * frame.width + sourceX;
+        return (frame.display[bit / BITS_PER_BYTE] >> (7 - bit % BITS_PER_BYTE)) &
+               1;
+    }
+};
+
+// a first pass for the largest resolution, which also validates the data
+std::optional<ExportGeometry> measure(std::span<const uint8_t> capture,
+                                      int scale) {
+    auto decoder = Chip8CaptureDecoder::open(capture);
+    if (!decoder || scale <= 0) {
+        return std::nullopt;
+    }
+    ExportGeometry geometry;
+    while (auto frame = decoder->next()) {
+        geometry.width = std::max(geometry.width, frame->width);
+        geometry.height = std::max(geometry.height, frame->height);
+    }
+    if (decoder->corrupt() || !geometry.width) {
+        return std::nullopt;
+    }
+    geometry.scale = scale;
+    return geometry;
+}
+
+uint32_t crc32(std::span<const uint8_t> data, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> table = {};
+        for (uint32_t n = 0; n < table.size(); n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }();
+    crc = ~crc;
+    for (uint8_t byte : data) {
+        crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void appendBigEndian(std::vector<uint8_t> &out, uint32_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+void writeChunk(std::ostream &out, const char *type,
+                std::span<const uint8_t> data) {
+    std::vector<uint8_t> chunk;
+    appendBigEndian(chunk, data.size(), 4);
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    appendBigEndian(chunk, crc32(std::span(chunk).subspan(4)), 4);
+    out.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+}
+
+// zlib stream of stored blocks
+std::vector<uint8_t> zlibStore(std::span<const uint8_t> data) {
+    constexpr std::size_t MAX_STORED = 0xFFFF;
+    std::vector<uint8_t> out = {0x78, 0x01};
+    std::size_t offset = 0;
+    do {
+        const std::size_t length = std::min(MAX_STORED, data.size() - offset);
+        out.push_back(offset + length == data.size());
+        out.push_back(length & 0xFF);
+        out.push_back(length >> 8);
+        out.push_back(~length & 0xFF);
+        out.push_back((~length >> 8) & 0xFF);
+        out.insert(out.end(), data.begin() + offset,
+                   data.begin() + offset + length);
+        offset += length;
+    } while (offset < data.size());
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t byte : data) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendBigEndian(out, b << 16 | a, 4);
+    return out;
+}
+
+// PNG scanlines of 1-bit pixels, each behind a "no filter" byte
+std::vector<uint8_t> scanlines(const Chip8CaptureDecoder::Frame &frame,
+                               const ExportGeometry &geometry) {
+    const int width = geometry.width * geometry.scale;
+    const int height = geometry.height * geometry.scale;
+    const int rowBytes = (width + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+    std::vector<uint8_t> rows((rowBytes + 1) * height, 0);
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = &rows[y * (rowBytes + 1) + 1];
+        for (int x = 0; x < width; x++) {
+            if (ExportGeometry::pixel(frame, x / geometry.scale,
+                                      y / geometry.scale, geometry)) {
+                row[x / BITS_PER_BYTE] |= 0x80 >> (x % BITS_PER_BYTE);
+            }
+        }
+    }
+    return rows;
+}
+
+} // namespace
+
+Chip8CaptureEncoder::Chip8CaptureEncoder(std::vector<uint8_t> &out) {
+    const CaptureHeader header = {
+        .magic = CAPTURE_MAGIC,
+        .version = CAPTURE_VERSION,
+        .framesPerSecond = Chip8::TARGET_FPS,
+        .reserved = 0,
+    };
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&header);
+    out.insert(out.end(), bytes, bytes + sizeof(header));
+}
+
+void Chip8CaptureEncoder::addFrame(std::span<const uint8_t> display,
+                                   int width, int height,
+                                   std::vector<uint8_t> &out) {
+    const std::size_t size = width * height / BITS_PER_BYTE;
+    if (width == previousWidth &&
+        std::equal(display.begin(), display.begin() + size,
+                   previous.begin())) {
+        if (++repeats == MAX_REPEATS) {
+            finish(out);
+        }
+        return;
+    }
+    finish(out);
+
+    // a resolution change deltas against a blank screen
+    if (width != previousWidth) {
+        previous.fill(0);
+        previousWidth = width;
+    }
+    std::array<uint8_t, Chip8::Chip8Hardware::HIRES_DISPLAY_SIZE> delta;
+    for (std::size_t i = 0; i < size; i++) {
+        delta[i] = display[i] ^ previous[i];
+    }
+    std::copy_n(display.begin(), size, previous.begin());
+    out.push_back(width == Chip8::CHIP8_DISPLAY_WIDTH ? LOW_RES_FRAME
+                                                      : HIGH_RES_FRAME);
+    writeFrameTokens(std::span(delta).first(size), out);
+}
+
+void Chip8CaptureEncoder::finish(std::vector<uint8_t> &out) {
+    if (repeats) {
+        out.push_back(REPEAT);
+        out.push_back(repeats - 1);
+        repeats = 0;
+    }
+}
+
+std::optional<Chip8CaptureDecoder>
+Chip8CaptureDecoder::open(std::span<const uint8_t> data) {
+    CaptureHeader header;
+    if (data.size() < sizeof(header)) {
+        return std::nullopt;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+        return std::nullopt;
+    }
+    Chip8CaptureDecoder decoder(data);
+    decoder.offset = sizeof(header);
+    return decoder;
+}
+
+std::optional<Chip8CaptureDecoder::Frame> Chip8CaptureDecoder::next() {
+    if (repeats) {
+        repeats--;
+        return Frame{width, height, std::span(current).first(width * height /
+                                                             BITS_PER_BYTE)};
+    }
+    if (offset >= data.size() || isCorrupt) {
+        return std::nullopt;
+    }
+    const uint8_t record = data[offset++];
+    if (record == REPEAT) {
+        if (offset >= data.size() || !width) {
+            isCorrupt = true;
+            return std::nullopt;
+        }
+        repeats = data[offset++] + 1;
+        return next();
+    }
+    if (record != LOW_RES_FRAME && record != HIGH_RES_FRAME) {
+        isCorrupt = true;
+        return std::nullopt;
+    }
+
+    const int newWidth = record == LOW_RES_FRAME ? Chip8::CHIP8_DISPLAY_WIDTH
+                                                 : Chip8::SCHIP_DISPLAY_WIDTH;
+    if (newWidth != width) {
+        current.fill(0);
+        width = newWidth;
+        height = record == LOW_RES_FRAME ? Chip8::CHIP8_DISPLAY_HEIGHT
+                                         : Chip8::SCHIP_DISPLAY_HEIGHT;
+    }
+    const std::size_t size = width * height / BITS_PER_BYTE;
+    std::size_t i = 0;
+    while (i < size) {
+        if (offset >= data.size()) {
+            isCorrupt = true;
+            return std::nullopt;
+        }
+        const uint8_t token = data[offset++];
+        const std::size_t count = token < MAX_RUN ? token + 1 : token - 0x7F;
+        if (i + count > size ||
+            (token >= MAX_RUN && offset + count > data.size())) {
+            isCorrupt = true;
+            return std::nullopt;
+        }
+        if (token >= MAX_RUN) {
+            for (std::size_t j = 0; j < count; j++) {
+                current[i + j] ^= data[offset + j];
+            }
+            offset += count;
+        }
+        i += count;
+    }
+    return Frame{width, height, std::span(current).first(size)};
+}
+
+bool Chip8CaptureExport::toY4m(std::span<const uint8_t> capture,
+                               std::ostream &out, int scale) {
+    auto geometry = measure(capture, scale);
+    if (!geometry) {
+        return false;
+    }
+    const int width = geometry->width * scale;
+    const int height = geometry->height * scale;
+    out << "YUV4MPEG2 W" << width << " H" << height << " F"
+        << Chip8::TARGET_FPS << ":1 Ip A1:1 Cmono\n";
+    std::vector<char> luma(width * height);
+    auto decoder = Chip8CaptureDecoder::open(capture);
+    while (auto frame = decoder->next()) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                luma[y * width + x] =
+                    ExportGeometry::pixel(*frame, x / scale, y / scale,
+                                          *geometry)
+                        ? 255
+                        : 0;
+            }
+        }
+        out << "FRAME\n";
+        out.write(luma.data(), luma.size());
+    }
+    return !decoder->corrupt() && out.good();
+}
+
+bool Chip8CaptureExport::toApng(std::span<const uint8_t> capture,
+                                std::ostream &out, int scale) {
+    auto geometry = measure(capture, scale);
+    if (!geometry) {
+        return false;
+    }
+    const uint32_t width = geometry->width * scale;
+    const uint32_t height = geometry->height * scale;
+    constexpr uint8_t SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A,
+                                     '\n'};
+    out.write(reinterpret_cast<const char *>(SIGNATURE), sizeof(SIGNATURE));
+
+    std::vector<uint8_t> chunk;
+    appendBigEndian(chunk, width, 4);
+    appendBigEndian(chunk, height, 4);
+    // 1-bit greyscale, deflate, adaptive filtering, no interlace
+    chunk.insert(chunk.end(), {1, 0, 0, 0, 0});
+    writeChunk(out, "IHDR", chunk);
+
+    // acTL needs the frame count up front; a frame delay is a 16-bit count
+    // of 1/60 s, so very long still runs are split
+    auto decoder = Chip8CaptureDecoder::open(capture);
+    constexpr uint32_t MAX_DELAY = 0xFFFF;
+    std::vector<uint32_t> delays;
+    {
+        std::vector<uint8_t> previous;
+        while (auto frame = decoder->next()) {
+            if (!delays.empty() && delays.back() < MAX_DELAY &&
+                std::ranges::equal(previous, frame->display)) {
+                delays.back()++;
+            } else {
+                previous.assign(frame->display.begin(), frame->display.end());
+                delays.push_back(1);
+            }
+        }
+    }
+    chunk.clear();
+    appendBigEndian(chunk, delays.size(), 4);
+    // loop forever
+    appendBigEndian(chunk, 0, 4);
+    writeChunk(out, "acTL", chunk);
+
+    decoder = Chip8CaptureDecoder::open(capture);
+    uint32_t sequence = 0;
+    std::size_t index = 0;
+    // frames still covered by the last APNG frame's delay
+    uint32_t covered = 0;
+    while (auto frame = decoder->next()) {
+        if (covered) {
+            covered--;
+            continue;
+        }
+        covered = delays[index] - 1;
+
+        chunk.clear();
+        appendBigEndian(chunk, sequence++, 4);
+        appendBigEndian(chunk, width, 4);
+        appendBigEndian(chunk, height, 4);
+        appendBigEndian(chunk, 0, 4);
+        appendBigEndian(chunk, 0, 4);
+        appendBigEndian(chunk, delays[index], 2);
+        appendBigEndian(chunk, Chip8::TARGET_FPS, 2);
+        // no dispose, source blend: each frame replaces the whole canvas
+        chunk.insert(chunk.end(), {0, 0});
+        writeChunk(out, "fcTL", chunk);
+
+        const auto data = zlibStore(scanlines(*frame, *geometry));
+        if (index == 0) {
+            writeChunk(out, "IDAT", data);
+        } else {
+            chunk.clear();
+            appendBigEndian(chunk, sequence++, 4);
+            chunk.insert(chunk.end(), data.begin(), data.end());
+            writeChunk(out, "fdAT", chunk);
+        }
+        index++;
+    }
+    writeChunk(out, "IEND", {});
+    return !decoder->corrupt() && out.good();
+}
+
+std::unique_ptr<Chip8CaptureWriter>
+Chip8CaptureWriter::open(const std::filesystem::path &path) {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if (file.fail()) {
+        return nullptr;
+    }
+    return std::unique_ptr<Chip8CaptureWriter>(
+        new Chip8CaptureWriter(std::move(file)));
+}
+
+Chip8CaptureWriter::Chip8CaptureWriter(std::ofstream file)
+    : file(std::move(file)),
+      encoderThread([this](std::stop_token stop) { drain(stop); }) {}
+
+Chip8CaptureWriter::~Chip8CaptureWriter() { close(); }
+
+bool Chip8CaptureWriter::close() {
+    if (encoderThread.joinable()) {
+        encoderThread.request_stop();
+        encoderThread.join();
+    }
+    return !writeFailed.load(std::memory_order_relaxed);
+}
+
+void Chip8CaptureWriter::push(std::span<const uint8_t> display, int width,
+                              int height) {
+    Frame frame;
+    std::copy(display.begin(), display.end(), frame.display.begin());
+    frame.width = width;
+    frame.height = height;
+    if (!frames.push(frame)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+}
+
+void Chip8CaptureWriter::drain(std::stop_token stop) {
+    std::stop_callback wakeOnStop(stop, [this] {
+        wakeups.fetch_add(1, std::memory_order_release);
+        wakeups.notify_one();
+    });
+    std::vector<uint8_t> out;
+    Chip8CaptureEncoder encoder(out);
+    // after the first failure the rest is encoded and thrown away
+    auto write = [&] {
+        if (!writeFailed.load(std::memory_order_relaxed)) {
+            file.write(reinterpret_cast<const char *>(out.data()), out.size());
+            writeFailed.store(file.fail(), std::memory_order_relaxed);
+        }
+        out.clear();
+    };
+    Frame frame;
+    for (;;) {
+        const uint32_t seen = wakeups.load(std::memory_order_acquire);
+        // checked before draining so frames pushed ahead of the stop are
+        // still written
+        const bool stopping = stop.stop_requested();
+        while (frames.pop(frame)) {
+            encoder.addFrame(frame.display, frame.width, frame.height, out);
+            if (out.size() >= WRITE_CHUNK) {
+                write();
+            }
+        }
+        if (stopping) {
+            break;
+        }
+        // until the next push or the stop request
+        wakeups.wait(seen, std::memory_order_acquire);
+    }
+    encoder.finish(out);
+    write();
+    file.close();
+    if (file.fail()) {
+        writeFailed.store(true, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,450 @@
+#include "chip8_disassembler.hpp"
+#include "chip8.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+
+namespace {
+constexpr const char *LOGIC_MNEMONICS[] = {
+    "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+};
+
+std::string format(const char *pattern, auto... args) {
+    char text[32];
+    snprintf(text, sizeof(text), pattern, args...);
+    return text;
+}
+
+// How an instruction leaves, as far as the graph is concerned.
+enum class Flow : uint8_t {
+    NEXT,
+    SKIP,
+    JUMP,
+    CALL,
+    COMPUTED_JUMP,
+    RETURN,
+    EXIT,
+    INVALID,
+};
+
+Flow flowOf(uint16_t instruction, const Chip8Quirks &quirks) {
+    if (!Chip8::isValidInstruction(instruction, quirks)) {
+        return Flow::INVALID;
+    }
+    switch (instruction >> 12) {
+    case 0x0:
+        return instruction == 0x00EE   ? Flow::RETURN
+               : instruction == 0x00FD ? Flow::EXIT
+                                       : Flow::NEXT;
+    case 0x1:
+        return Flow::JUMP;
+    case 0x2:
+        return Flow::CALL;
+    case 0x5:
+        // XO-CHIP's 5XY2 and 5XY3 are register range stores and loads
+        return quirks.xoChip && ((instruction & 0xF) == 2 ||
+                                 (instruction & 0xF) == 3)
+                   ? Flow::NEXT
+                   : Flow::SKIP;
+    case 0x3:
+    case 0x4:
+    case 0x9:
+    case 0xE:
+        return Flow::SKIP;
+    case 0xB:
+        return Flow::COMPUTED_JUMP;
+    default:
+        return Flow::NEXT;
+    }
+}
+
+uint16_t fetch(std::span<const uint8_t> memory, uint16_t address) {
+    return memory[address] << 8 | memory[address + 1];
+}
+
+// XO-CHIP's F000 NNNN is the only four byte instruction
+int lengthOf(uint16_t instruction, const Chip8Quirks &quirks) {
+    return quirks.xoChip && instruction == 0xF000 ? 4 : 2;
+}
+
+int lengthAt(std::span<const uint8_t> memory, std::size_t address,
+             const Chip8Quirks &quirks) {
+    return address + 1 < memory.size()
+               ? lengthOf(fetch(memory, address), quirks)
+               : 2;
+}
+} // namespace
+
+std::string Chip8Disassembler::disassemble(uint16_t instruction,
+                                           const Chip8Quirks &quirks) {
+    if (!Chip8::isValidInstruction(instruction, quirks)) {
+        return format("DW 0x%04X", instruction);
+    }
+    const int x = (instruction & 0x0F00) >> 8;
+    const int y = (instruction & 0x00F0) >> 4;
+    const int n = instruction & 0x000F;
+    const int kk = instruction & 0x00FF;
+    const int nnn = instruction & 0x0FFF;
+    switch (instruction >> 12) {
+    case 0x0:
+        if ((instruction & 0xFFF0) == 0x00C0) {
+            return format("SCD %d", n);
+        } else if ((instruction & 0xFFF0) == 0x00D0) {
+            return format("SCU %d", n);
+        }
+        switch (instruction) {
+        case 0x00E0:
+            return "CLS";
+        case 0x00EE:
+            return "RET";
+        case 0x00FB:
+            return "SCR";
+        case 0x00FC:
+            return "SCL";
+        case 0x00FD:
+            return "EXIT";
+        case 0x00FE:
+            return "LOW";
+        case 0x00FF:
+            return "HIGH";
+        }
+        break;
+    case 0x1:
+        return format("JP 0x%03X", nnn);
+    case 0x2:
+        return format("CALL 0x%03X", nnn);
+    case 0x3:
+        return format("SE V%X, 0x%02X", x, kk);
+    case 0x4:
+        return format("SNE V%X, 0x%02X", x, kk);
+    case 0x5:
+        if (quirks.xoChip && n == 2) {
+            return format("LD [I], V%X-V%X", x, y);
+        } else if (quirks.xoChip && n == 3) {
+            return format("LD V%X-V%X, [I]", x, y);
+        }
+        return format("SE V%X, V%X", x, y);
+    case 0x6:
+        return format("LD V%X, 0x%02X", x, kk);
+    case 0x7:
+        return format("ADD V%X, 0x%02X", x, kk);
+    case 0x8:
+        if (n <= 0x7) {
+            return format("%s V%X, V%X", LOGIC_MNEMONICS[n], x, y);
+        } else if (n == 0xE) {
+            return format("SHL V%X, V%X", x, y);
+        }
+        break;
+    case 0x9:
+        return format("SNE V%X, V%X", x, y);
+    case 0xA:
+        return format("LD I, 0x%03X", nnn);
+    case 0xB:
+        return format("JP V0, 0x%03X", nnn);
+    case 0xC:
+        return format("RND V%X, 0x%02X", x, kk);
+    case 0xD:
+        return format("DRW V%X, V%X, %d", x, y, n);
+    case 0xE:
+        if (kk == 0x9E) {
+            return format("SKP V%X", x);
+        } else if (kk == 0xA1) {
+            return format("SKNP V%X", x);
+        }
+        break;
+    default:
+        switch (kk) {
+        case 0x00:
+            return "LD I, LONG";
+        case 0x01:
+            return format("PLANE %d", x);
+        case 0x02:
+            return "AUDIO";
+        case 0x07:
+            return format("LD V%X, DT", x);
+        case 0x0A:
+            return format("LD V%X, K", x);
+        case 0x15:
+            return format("LD DT, V%X", x);
+        case 0x18:
+            return format("LD ST, V%X", x);
+        case 0x1E:
+            return format("ADD I, V%X", x);
+        case 0x29:
+            return format("LD F, V%X", x);
+        case 0x30:
+            return format("LD HF, V%X", x);
+        case 0x33:
+            return format("LD B, V%X", x);
+        case 0x3A:
+            return format("PITCH V%X", x);
+        case 0x55:
+            return format("LD [I], V%X", x);
+        case 0x65:
+            return format("LD V%X, [I]", x);
+        case 0x75:
+            return format("LD R, V%X", x);
+        case 0x85:
+            return format("LD V%X, R", x);
+        }
+        break;
+    }
+    return format("DW 0x%04X", instruction);
+}
+
+Chip8Disassembler::ControlFlowGraph
+Chip8Disassembler::buildCfg(std::span<const uint8_t> memory, uint16_t entry,
+                            const Chip8Quirks &quirks) {
+    ControlFlowGraph cfg;
+    cfg.entry = entry;
+    cfg.quirks = quirks;
+    const std::size_t size = memory.size();
+    // instructions may start at odd addresses and overlap, so both maps
+    // are per byte
+    std::vector<bool> reachable(size);
+    std::vector<bool> leader(size);
+
+    if (entry >= size) {
+        return cfg;
+    }
+    std::vector<uint16_t> pending = {entry};
+    leader[entry] = true;
+    auto follow = [&](uint16_t target, bool startsBlock) {
+        if (target >= size) {
+            return;
+        }
+        leader[target] = leader[target] || startsBlock;
+        if (!reachable[target]) {
+            pending.push_back(target);
+        }
+    };
+    while (!pending.empty()) {
+        const uint16_t pc = pending.back();
+        pending.pop_back();
+        if (reachable[pc]) {
+            continue;
+        }
+        reachable[pc] = true;
+        if (pc + 1u >= size) {
+            // runs off the end of memory
+            cfg.invalidInstructions.push_back(pc);
+            continue;
+        }
+        const uint16_t instruction = fetch(memory, pc);
+        const uint16_t next = pc + lengthOf(instruction, quirks);
+        switch (flowOf(instruction, quirks)) {
+        case Flow::NEXT:
+            follow(next, false);
+            break;
+        case Flow::SKIP:
+            // skips step over the whole of a following F000 NNNN
+            follow(next, true);
+            follow(next + lengthAt(memory, next, quirks), true);
+            break;
+        case Flow::JUMP:
+            follow(instruction & 0x0FFF, true);
+            break;
+        case Flow::CALL:
+            follow(instruction & 0x0FFF, true);
+            follow(next, true);
+            cfg.subroutines.push_back(instruction & 0x0FFF);
+            break;
+        case Flow::COMPUTED_JUMP:
+            cfg.computedJumps.push_back(pc);
+            break;
+        case Flow::INVALID:
+            cfg.invalidInstructions.push_back(pc);
+            break;
+        case Flow::RETURN:
+        case Flow::EXIT:
+            break;
+        }
+    }
+
+    // cut the reachable instructions into blocks at every leader and after
+    // every instruction that does not simply fall through
+    std::vector<bool> code(size);
+    for (std::size_t start = 0; start < size; start++) {
+        if (!leader[start] || !reachable[start]) {
+            continue;
+        }
+        BasicBlock block;
+        block.start = start;
+        uint16_t pc = start;
+        while (true) {
+            if (pc + 1u >= size) {
+                block.end = pc;
+                break;
+            }
+            const uint16_t instruction = fetch(memory, pc);
+            const int length = lengthOf(instruction, quirks);
+            std::fill_n(code.begin() + pc,
+                        std::min<std::size_t>(length, size - pc), true);
+            const uint16_t next = pc + length;
+            block.end = next;
+            const Flow flow = flowOf(instruction, quirks);
+            if (flow == Flow::NEXT) {
+                if (next < size && reachable[next] && !leader[next]) {
+                    pc = next;
+                    continue;
+                }
+                if (next < size) {
+                    block.successors.push_back(next);
+                }
+            } else if (flow == Flow::SKIP) {
+                const uint16_t skipped = next + lengthAt(memory, next, quirks);
+                for (uint16_t target : {next, skipped}) {
+                    if (target < size) {
+                        block.successors.push_back(target);
+                    }
+                }
+            } else if (flow == Flow::JUMP &&
+                       (instruction & 0x0FFF) < size) {
+                block.successors.push_back(instruction & 0x0FFF);
+            } else if (flow == Flow::CALL) {
+                block.call = instruction & 0x0FFF;
+            }
+            block.computedJump = flow == Flow::COMPUTED_JUMP;
+            block.returns = flow == Flow::RETURN;
+            break;
+        }
+        cfg.blocks.emplace(block.start, std::move(block));
+    }
+
+    // follow I through each block to find where FX33, FX55 and XO-CHIP's
+    // 5XY2 write; I is unknown at every block entry
+    for (const auto &[start, block] : cfg.blocks) {
+        std::optional<uint16_t> index;
+        for (uint16_t pc = start; pc + 1u < size && pc < block.end;
+             pc += lengthOf(fetch(memory, pc), quirks)) {
+            const uint16_t instruction = fetch(memory, pc);
+            const int x = (instruction & 0x0F00) >> 8;
+            const int y = (instruction & 0x00F0) >> 4;
+            const bool rangeStore =
+                quirks.xoChip && (instruction & 0xF00F) == 0x5002;
+            const int length = (instruction & 0xF0FF) == 0xF033 ? 3
+                               : (instruction & 0xF0FF) == 0xF055 ? x + 1
+                               : rangeStore ? std::abs(x - y) + 1
+                                            : 0;
+            if ((instruction & 0xF000) == 0xA000) {
+                index = instruction & 0x0FFF;
+            } else if (quirks.xoChip && instruction == 0xF000) {
+                index = pc + 3u < size ? std::optional<uint16_t>(
+                                             fetch(memory, pc + 2))
+                                       : std::nullopt;
+            } else if (length && !index) {
+                cfg.unresolvedStores.push_back(pc);
+            } else if (length) {
+                // a long I can point past a 4 KB image
+                const int begin = std::min<int>(*index, size);
+                const int end = std::min<int>(*index + length, size);
+                if (std::any_of(code.begin() + begin, code.begin() + end,
+                                [](bool isCode) { return isCode; })) {
+                    cfg.selfModifying.push_back(
+                        {pc, *index, static_cast<uint16_t>(length)});
+                }
+                if ((instruction & 0xF0FF) == 0xF055) {
+                    // some interpreters move I, depending on the quirks
+                    index.reset();
+                }
+            } else if ((instruction & 0xF000) == 0xF000 &&
+                       ((instruction & 0xFF) == 0x1E ||
+                        (instruction & 0xFF) == 0x29 ||
+                        (instruction & 0xFF) == 0x30 ||
+                        (instruction & 0xFF) == 0x65)) {
+                index.reset();
+            }
+        }
+    }
+
+    std::ranges::sort(cfg.subroutines);
+    auto duplicates = std::ranges::unique(cfg.subroutines);
+    cfg.subroutines.erase(duplicates.begin(), duplicates.end());
+    std::ranges::sort(cfg.computedJumps);
+    std::ranges::sort(cfg.invalidInstructions);
+    std::ranges::sort(cfg.unresolvedStores);
+    return cfg;
+}
+
+std::string Chip8Disassembler::listing(std::span<const uint8_t> memory,
+                                       const ControlFlowGraph &cfg) {
+    std::string out;
+    char line[96];
+    for (const auto &[start, block] : cfg.blocks) {
+        if (std::ranges::binary_search(cfg.subroutines, start)) {
+            snprintf(line, sizeof(line), "\nsub_0x%03X:\n", start);
+            out += line;
+        } else if (start == cfg.entry) {
+            out += "\nmain:\n";
+        } else {
+            out += "\n";
+        }
+        for (uint16_t pc = start; pc + 1u < memory.size() && pc < block.end;
+             pc += lengthOf(fetch(memory, pc), cfg.quirks)) {
+            const uint16_t instruction = fetch(memory, pc);
+            std::string mnemonic = disassemble(instruction, cfg.quirks);
+            if (lengthOf(instruction, cfg.quirks) == 4 &&
+                pc + 3u < memory.size()) {
+                mnemonic += format(" 0x%04X", fetch(memory, pc + 2));
+            }
+            snprintf(line, sizeof(line), "0x%03X  %04X  %-16s", pc,
+                     instruction, mnemonic.c_str());
+            std::string text = line;
+            for (const auto &write : cfg.selfModifying) {
+                if (write.pc == pc) {
+                    snprintf(line, sizeof(line),
+                             " ; writes code at 0x%03X-0x%03X", write.address,
+                             write.address + write.length - 1);
+                    text += line;
+                }
+            }
+            if (std::ranges::binary_search(cfg.unresolvedStores, pc)) {
+                text += " ; store through unknown I";
+            }
+            if (std::ranges::binary_search(cfg.computedJumps, pc)) {
+                text += " ; computed jump";
+            }
+            if (std::ranges::binary_search(cfg.invalidInstructions, pc)) {
+                text += " ; invalid";
+            }
+            while (!text.empty() && text.back() == ' ') {
+                text.pop_back();
+            }
+            out += text + "\n";
+        }
+        if (!block.successors.empty() && !block.call) {
+            out += "           ; ->";
+            for (uint16_t successor : block.successors) {
+                snprintf(line, sizeof(line), " 0x%03X", successor);
+                out += line;
+            }
+            out += "\n";
+        }
+    }
+    return out;
+}
+
+std::string Chip8Disassembler::toDot(const ControlFlowGraph &cfg) {
+    std::string out = "digraph cfg {\n  node [shape=box fontname=monospace];\n";
+    char line[96];
+    for (const auto &[start, block] : cfg.blocks) {
+        snprintf(line, sizeof(line), "  b%03X [label=\"0x%03X-0x%03X%s\"];\n",
+                 start, start, block.end - 2,
+                 block.computedJump ? "\\nBNNN" : "");
+        out += line;
+        for (uint16_t successor : block.successors) {
+            snprintf(line, sizeof(line), "  b%03X -> b%03X;\n", start,
+                     successor);
+            out += line;
+        }
+        if (block.call) {
+            snprintf(line, sizeof(line),
+                     "  b%03X -> b%03X [style=dashed];\n  b%03X -> b%03X;\n",
+                     start, *block.call, start, block.end);
+            out += line;
+        }
+    }
+    out += "}\n";
+    return out;
+}
@@ -0,0 +1,125 @@
+#include "chip8_farm.hpp"
+#include "common.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace {
+
+// One queue per worker. The owner pops from the back and idle workers
+// steal from the front, so they rarely contend on the same end.
+struct alignas(64) WorkQueue {
+    std::mutex mutex;
+    std::deque<std::size_t> jobs;
+
+    void push(std::size_t job) {
+        std::lock_guard lock(mutex);
+        jobs.push_back(job);
+    }
+
+    std::optional<std::size_t> pop() {
+        std::lock_guard lock(mutex);
+        if (jobs.empty()) {
+            return std::nullopt;
+        }
+        std::size_t job = jobs.back();
+        jobs.pop_back();
+        return job;
+    }
+
+    std::optional<std::size_t> steal() {
+        std::lock_guard lock(mutex);
+        if (jobs.empty()) {
+            return std::nullopt;
+        }
+        std::size_t job = jobs.front();
+        jobs.pop_front();
+        return job;
+    }
+};
+
+} // namespace
+
+Chip8Farm::Chip8Farm(int threads) : threads(threads) {
+    if (this->threads <= 0) {
+        this->threads =
+            std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+}
+
+uint64_t Chip8Farm::hashDisplay(const Chip8 &emulator) {
+    uint64_t hash = fnv1a(emulator.getDisplayBuffer());
+    if (emulator.getQuirks().xoChip) {
+        hash = fnv1a(emulator.getDisplayBuffer(1), hash);
+    }
+    return hash;
+}
+
+Chip8Farm::JobResult Chip8Farm::runJob(const Job &job) {
+    JobResult result;
+    result.name = job.name;
+
+    // too large for a worker stack once a few are alive at once
+    auto emulator = job.seed ? std::make_unique<Chip8>(*job.seed)
+                             : std::make_unique<Chip8>();
+    emulator->setQuirks(job.quirks);
+    result.status = emulator->loadProgram(job.rom);
+    if (result.status == Chip8::Status::OK) {
+        emulator->precompile();
+    }
+
+    Chip8InputPlayback playback(job.inputs);
+    for (int frame = 0;
+         frame < job.frames && result.status == Chip8::Status::OK; frame++) {
+        playback.apply(*emulator, frame);
+        result.status = emulator->runFrame(job.instructionsPerFrame);
+        result.framesRun++;
+    }
+
+    result.displayHash = hashDisplay(*emulator);
+    result.state = emulator->getState().toString();
+    return result;
+}
+
+Chip8Farm::Report Chip8Farm::run(const std::vector<Job> &jobs) const {
+    Report report;
+    report.results.resize(jobs.size());
+    report.threads = std::max<int>(
+        1, std::min<std::size_t>(threads, jobs.size()));
+
+    std::vector<WorkQueue> queues(report.threads);
+    for (std::size_t job = 0; job < jobs.size(); job++) {
+        queues[job % report.threads].push(job);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> workers;
+        for (int worker = 0; worker < report.threads; worker++) {
+            workers.emplace_back([&, worker] {
+                for (;;) {
+                    auto job = queues[worker].pop();
+                    for (int victim = 1; !job && victim < report.threads;
+                         victim++) {
+                        job = queues[(worker + victim) % report.threads]
+                                  .steal();
+                    }
+                    // every job is queued up front, so empty queues mean
+                    // there is nothing left to run or steal
+                    if (!job) {
+                        return;
+                    }
+                    report.results[*job] = runJob(jobs[*job]);
+                }
+            });
+        }
+    }
+    report.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    return report;
+}
@@ -0,0 +1,535 @@
+#include "chip8_lockstep.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Lanes of a condition mask are 0 or 0xFF; reduce them a word at a time.
+template <typename Bytes> bool noneSet(const Bytes &mask) {
+    uint64_t words[sizeof(Bytes) / sizeof(uint64_t)];
+    memcpy(words, &mask, sizeof(Bytes));
+    uint64_t any = 0;
+    for (uint64_t word : words) {
+        any |= word;
+    }
+    return any == 0;
+}
+
+template <typename Bytes> bool allSet(const Bytes &mask) {
+    uint64_t words[sizeof(Bytes) / sizeof(uint64_t)];
+    memcpy(words, &mask, sizeof(Bytes));
+    uint64_t all = ~0ull;
+    for (uint64_t word : words) {
+        all &= word;
+    }
+    return all == ~0ull;
+}
+
+} // namespace
+
+template <int Lanes>
+Chip8Lockstep<Lanes>::Chip8Lockstep(uint32_t seed)
+    : dist(std::numeric_limits<uint8_t>::min(),
+           std::numeric_limits<uint8_t>::max()) {
+    PC = PC + static_cast<uint16_t>(Hardware::PROGRAM_START);
+    live = ~live;
+    liveWords = ~liveWords;
+    status.fill(Status::OK);
+    for (int lane = 0; lane < Lanes; lane++) {
+        gen[lane].seed(seed + lane);
+        memcpy(memory[lane].data(), Chip8::Chip8Sprites::sprites.data(),
+               Chip8::Chip8Sprites::SPRITE_MEMORY_SIZE);
+    }
+}
+
+template <int Lanes>
+Chip8::Status
+Chip8Lockstep<Lanes>::loadProgram(std::span<const uint8_t> program) {
+    if (program.size() + Hardware::PROGRAM_START > MEMORY_SIZE) {
+        return Status::ROM_OVERSIZED;
+    }
+    for (auto &laneMemory : memory) {
+        memcpy(&laneMemory[Hardware::PROGRAM_START], program.data(),
+               program.size());
+    }
+    return Status::OK;
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::setKeyState(int lane, uint16_t keyState) {
+    KEY_STATE[lane] = keyState;
+}
+
+template <int Lanes>
+std::span<const uint8_t, Chip8::Chip8Hardware::DISPLAY_SIZE>
+Chip8Lockstep<Lanes>::getDisplayBuffer(int lane) const {
+    return std::span(memory[lane])
+        .template subspan<Hardware::DISPLAY_START, Hardware::DISPLAY_SIZE>();
+}
+
+template <int Lanes>
+Chip8::Chip8Hardware Chip8Lockstep<Lanes>::getLaneHardware(int lane) const {
+    Hardware hardware;
+    std::copy(memory[lane].begin(), memory[lane].end(),
+              hardware.MEMORY.begin());
+    for (int r = 0; r < Hardware::REGISTER_COUNT; r++) {
+        hardware.REGISTERS[r] = V[r][lane];
+    }
+    memcpy(hardware.STACK, stack[lane].data(), Hardware::STACK_SIZE);
+    hardware.KEY_STATE = KEY_STATE[lane];
+    hardware.PC = together && live[lane] ? sharedPC : PC[lane];
+    hardware.SP = SP[lane];
+    hardware.I = I[lane];
+    hardware.DELAY_TIMER = DELAY_TIMER[lane];
+    hardware.SOUND_TIMER = SOUND_TIMER[lane];
+    return hardware;
+}
+
+// failed lanes keep ticking, like a Chip8 whose frames stop early
+template <int Lanes> void Chip8Lockstep<Lanes>::decrementTimers() {
+    DELAY_TIMER -= reinterpret_cast<ByteLanes>(DELAY_TIMER != 0) & 1;
+    SOUND_TIMER -= reinterpret_cast<ByteLanes>(SOUND_TIMER != 0) & 1;
+}
+
+template <int Lanes>
+Chip8::Status Chip8Lockstep<Lanes>::runFrame(int instructionsPerFrame) {
+    Status result = Status::OK;
+    for (int i = 0; i < instructionsPerFrame; i++) {
+        Status stepStatus = step();
+        if (result == Status::OK) {
+            result = stepStatus;
+        }
+    }
+    decrementTimers();
+    return result;
+}
+
+template <int Lanes>
+bool Chip8Lockstep<Lanes>::sharedInstruction(uint16_t &instruction) const {
+    const uint16_t pc = sharedPC;
+    if (pc + 1 >= MEMORY_SIZE) {
+        return false;
+    }
+    instruction = memory[leader][pc] << 8 | memory[leader][pc + 1];
+
+    // code every lane loaded from the ROM is identical; only stores and
+    // the display can make lanes disagree about the instruction at pc
+    if (pc >= Hardware::DISPLAY_START || written[pc] || written[pc + 1]) {
+        for (int lane = 0; lane < Lanes; lane++) {
+            if (live[lane] && (memory[lane][pc] != memory[leader][pc] ||
+                               memory[lane][pc + 1] != memory[leader][pc + 1])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <int Lanes> void Chip8Lockstep<Lanes>::diverge() {
+    assign(PC, (PC & 0) + sharedPC);
+    together = false;
+}
+
+template <int Lanes> void Chip8Lockstep<Lanes>::tryConverge() {
+    if (leader == Lanes) {
+        return;
+    }
+    const uint16_t pc = PC[leader];
+    if (allSet(reinterpret_cast<WordLanes>(PC == pc) | ~liveWords)) {
+        sharedPC = pc;
+        together = true;
+    }
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::skipWhere(const ByteLanes &condition) {
+    if (noneSet(condition & live)) {
+        sharedPC += 2;
+    } else if (allSet(condition | ~live)) {
+        sharedPC += 4;
+    } else {
+        diverge();
+        WordLanes skip;
+        widen(skip, condition & 2);
+        assign(PC, PC + 2 + skip);
+    }
+}
+
+template <int Lanes>
+bool Chip8Lockstep<Lanes>::stepVector(uint16_t instruction) {
+    const int x = (instruction & 0x0F00) >> 8;
+    const int y = (instruction & 0x00F0) >> 4;
+    const int nnn = (instruction & 0x0FFF);
+    const uint8_t kk = (instruction & 0x00FF);
+
+    switch ((instruction & 0xF000) >> 12) {
+    case 0x1:
+        sharedPC = nnn;
+        return true;
+    case 0x3:
+        skipWhere(reinterpret_cast<ByteLanes>(V[x] == kk));
+        return true;
+    case 0x4:
+        skipWhere(reinterpret_cast<ByteLanes>(V[x] != kk));
+        return true;
+    case 0x5:
+        skipWhere(reinterpret_cast<ByteLanes>(V[x] == V[y]));
+        return true;
+    case 0x6:
+        assign(V[x], (V[x] & 0) + kk);
+        break;
+    case 0x7:
+        assign(V[x], V[x] + kk);
+        break;
+    case 0x8:
+        // same read/write order as the scalar handlers so VF aliasing
+        // with X or Y gives identical results
+        switch (instruction & 0xF) {
+        case 0x0:
+            assign(V[x], V[y]);
+            break;
+        case 0x1:
+            assign(V[x], V[x] | V[y]);
+            break;
+        case 0x2:
+            assign(V[x], V[x] & V[y]);
+            break;
+        case 0x3:
+            assign(V[x], V[x] ^ V[y]);
+            break;
+        case 0x4: {
+            ByteLanes total = V[x] + V[y];
+            ByteLanes carry = reinterpret_cast<ByteLanes>(total < V[x]) & 1;
+            assign(V[0xF], carry);
+            assign(V[x], total);
+            break;
+        }
+        case 0x5:
+            assign(V[0xF], reinterpret_cast<ByteLanes>(V[x] >= V[y]) & 1);
+            assign(V[x], V[x] - V[y]);
+            break;
+        case 0x6:
+            assign(V[0xF], V[x] & 1);
+            assign(V[x], V[x] >> 1);
+            break;
+        case 0x7:
+            assign(V[0xF], reinterpret_cast<ByteLanes>(V[y] >= V[x]) & 1);
+            assign(V[x], V[y] - V[x]);
+            break;
+        case 0xE:
+            assign(V[0xF], (V[x] >> 7) & 1);
+            assign(V[x], V[x] << 1);
+            break;
+        default:
+            return false;
+        }
+        break;
+    case 0x9:
+        skipWhere(reinterpret_cast<ByteLanes>(V[x] != V[y]));
+        return true;
+    case 0xA:
+        assign(I, (I & 0) + static_cast<uint16_t>(nnn));
+        break;
+    case 0xE: {
+        WordLanes key;
+        widen(key, V[x] & 0xF);
+        ByteLanes down;
+        narrow(down, (KEY_STATE >> key) & 1);
+        down = -down;
+        switch (kk) {
+        case 0x9E:
+            skipWhere(down);
+            return true;
+        case 0xA1:
+            skipWhere(~down);
+            return true;
+        default:
+            return false;
+        }
+    }
+    case 0xF:
+        switch (kk) {
+        case 0x07:
+            assign(V[x], DELAY_TIMER);
+            break;
+        case 0x15:
+            assign(DELAY_TIMER, V[x]);
+            break;
+        case 0x18:
+            assign(SOUND_TIMER, V[x]);
+            break;
+        case 0x1E: {
+            WordLanes value;
+            widen(value, V[x]);
+            assign(I, I + value);
+            break;
+        }
+        case 0x29: {
+            WordLanes value;
+            widen(value, V[x]);
+            assign(I, value * static_cast<uint16_t>(
+                                  Chip8::Chip8Sprites::SPRITE_HEIGHT) +
+                          static_cast<uint16_t>(Hardware::FONT_SET_START));
+            break;
+        }
+        default:
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    sharedPC += 2;
+    return true;
+}
+
+template <int Lanes> Chip8::Status Chip8Lockstep<Lanes>::stepLane(int lane) {
+    auto &laneMemory = memory[lane];
+    auto &laneStack = stack[lane];
+    const uint16_t pc = PC[lane];
+    const uint16_t instruction =
+        laneMemory[pc & (MEMORY_SIZE - 1)] << 8 |
+        laneMemory[(pc + 1) & (MEMORY_SIZE - 1)];
+    const int x = (instruction & 0x0F00) >> 8;
+    const int y = (instruction & 0x00F0) >> 4;
+    const int nnn = (instruction & 0x0FFF);
+    const int n = (instruction & 0x000F);
+    const uint8_t kk = (instruction & 0x00FF);
+    uint16_t nextPC = pc + 2;
+
+    switch ((instruction & 0xF000) >> 12) {
+    case 0x0:
+        if (instruction == 0x00E0) {
+            memset(&laneMemory[Hardware::DISPLAY_START], 0,
+                   Hardware::DISPLAY_SIZE);
+        } else if (instruction == 0x00EE) {
+            if (SP[lane] < 2) {
+                return Status::STACK_UNDERFLOW;
+            }
+            SP[lane] -= 2;
+            nextPC = (laneStack[SP[lane]] << 8 | laneStack[SP[lane] + 1]) + 2;
+        } else {
+            return Status::INVALID_INSTRUCTION;
+        }
+        break;
+    case 0x1:
+        nextPC = nnn;
+        break;
+    case 0x2:
+        if (SP[lane] + 2 > Hardware::STACK_SIZE) {
+            return Status::STACK_OVERFLOW;
+        }
+        laneStack[SP[lane]] = pc >> 8;
+        laneStack[SP[lane] + 1] = pc & 0xFF;
+        SP[lane] += 2;
+        nextPC = nnn;
+        break;
+    case 0x3:
+        nextPC += V[x][lane] == kk ? 2 : 0;
+        break;
+    case 0x4:
+        nextPC += V[x][lane] != kk ? 2 : 0;
+        break;
+    case 0x5:
+        nextPC += V[x][lane] == V[y][lane] ? 2 : 0;
+        break;
+    case 0x6:
+        V[x][lane] = kk;
+        break;
+    case 0x7:
+        V[x][lane] += kk;
+        break;
+    case 0x8: {
+        switch (instruction & 0xF) {
+        case 0x0:
+            V[x][lane] = V[y][lane];
+            break;
+        case 0x1:
+            V[x][lane] |= V[y][lane];
+            break;
+        case 0x2:
+            V[x][lane] &= V[y][lane];
+            break;
+        case 0x3:
+            V[x][lane] ^= V[y][lane];
+            break;
+        case 0x4: {
+            int total = V[x][lane] + V[y][lane];
+            V[0xF][lane] = total > std::numeric_limits<uint8_t>::max();
+            V[x][lane] = static_cast<uint8_t>(total);
+            break;
+        }
+        case 0x5:
+            V[0xF][lane] = V[x][lane] >= V[y][lane];
+            V[x][lane] -= V[y][lane];
+            break;
+        case 0x6:
+            V[0xF][lane] = V[x][lane] & 1;
+            V[x][lane] = V[x][lane] >> 1;
+            break;
+        case 0x7:
+            V[0xF][lane] = V[y][lane] >= V[x][lane];
+            V[x][lane] = V[y][lane] - V[x][lane];
+            break;
+        case 0xE:
+            V[0xF][lane] = (V[x][lane] >> 7) & 1;
+            V[x][lane] = V[x][lane] << 1;
+            break;
+        default:
+            return Status::INVALID_INSTRUCTION;
+        }
+        break;
+    }
+    case 0x9:
+        nextPC += V[x][lane] != V[y][lane] ? 2 : 0;
+        break;
+    case 0xA:
+        I[lane] = nnn;
+        break;
+    case 0xB:
+        nextPC = nnn + V[0][lane];
+        break;
+    case 0xC:
+        V[x][lane] = dist(gen[lane]) & kk;
+        break;
+    case 0xD: {
+        auto display =
+            std::span(laneMemory)
+                .template subspan<Hardware::DISPLAY_START,
+                                  Hardware::DISPLAY_SIZE>();
+        if (I[lane] + n > MEMORY_SIZE) {
+            return Status::MEMORY_OUT_OF_BOUNDS;
+        }
+        // VF is cleared before the coordinates are read, like Chip8
+        V[0xF][lane] = 0;
+        uint8_t xPosition = V[x][lane];
+        uint8_t yPosition = V[y][lane];
+        if (Chip8::drawSprite(display, std::span(&laneMemory[I[lane]], n),
+                              xPosition, yPosition)) {
+            V[0xF][lane] = 1;
+        }
+        break;
+    }
+    case 0xE: {
+        bool pressed = (KEY_STATE[lane] >> (V[x][lane] & 0xF)) & 1;
+        if (kk == 0x9E) {
+            nextPC += pressed ? 2 : 0;
+        } else if (kk == 0xA1) {
+            nextPC += pressed ? 0 : 2;
+        } else {
+            return Status::INVALID_INSTRUCTION;
+        }
+        break;
+    }
+    case 0xF:
+        switch (kk) {
+        case 0x07:
+            V[x][lane] = DELAY_TIMER[lane];
+            break;
+        case 0x0A:
+            if (!waitingForKeyUp[lane] && KEY_STATE[lane]) {
+                keyPressed[lane] = std::countr_zero(KEY_STATE[lane]);
+                waitingForKeyUp[lane] = true;
+                nextPC = pc;
+            } else if (waitingForKeyUp[lane] && !KEY_STATE[lane]) {
+                waitingForKeyUp[lane] = false;
+                V[x][lane] = keyPressed[lane];
+            } else {
+                nextPC = pc;
+            }
+            break;
+        case 0x15:
+            DELAY_TIMER[lane] = V[x][lane];
+            break;
+        case 0x18:
+            SOUND_TIMER[lane] = V[x][lane];
+            break;
+        case 0x1E:
+            I[lane] += V[x][lane];
+            break;
+        case 0x29:
+            I[lane] = Hardware::FONT_SET_START +
+                      V[x][lane] * Chip8::Chip8Sprites::SPRITE_HEIGHT;
+            break;
+        case 0x33: {
+            if (I[lane] + 3 > MEMORY_SIZE) {
+                return Status::MEMORY_OUT_OF_BOUNDS;
+            }
+            int value = V[x][lane];
+            laneMemory[I[lane]] = value / 100;
+            laneMemory[I[lane] + 1] = (value / 10) % 10;
+            laneMemory[I[lane] + 2] = value % 10;
+            for (int i = 0; i < 3; i++) {
+                written.set((I[lane] + i) & (MEMORY_SIZE - 1));
+            }
+            break;
+        }
+        case 0x55:
+            if (I[lane] + x + 1 > MEMORY_SIZE) {
+                return Status::MEMORY_OUT_OF_BOUNDS;
+            }
+            for (int r = 0; r <= x; r++) {
+                laneMemory[I[lane] + r] = V[r][lane];
+                written.set((I[lane] + r) & (MEMORY_SIZE - 1));
+            }
+            break;
+        case 0x65:
+            if (I[lane] + x + 1 > MEMORY_SIZE) {
+                return Status::MEMORY_OUT_OF_BOUNDS;
+            }
+            for (int r = 0; r <= x; r++) {
+                V[r][lane] = laneMemory[I[lane] + r];
+            }
+            break;
+        default:
+            return Status::INVALID_INSTRUCTION;
+        }
+        break;
+    }
+    PC[lane] = nextPC;
+    return Status::OK;
+}
+
+template <int Lanes> Chip8::Status Chip8Lockstep<Lanes>::step() {
+    if (leader == Lanes) {
+        // every lane has failed
+        return status[0];
+    }
+    if (together) {
+        uint16_t instruction;
+        if (sharedInstruction(instruction) && stepVector(instruction)) {
+            vectorSteps++;
+            return Status::OK;
+        }
+        diverge();
+    }
+
+    scalarSteps++;
+    Status result = Status::OK;
+    for (int lane = 0; lane < Lanes; lane++) {
+        if (!live[lane]) {
+            continue;
+        }
+        Status laneStatus = stepLane(lane);
+        if (laneStatus != Status::OK) {
+            status[lane] = laneStatus;
+            live[lane] = 0;
+            liveWords[lane] = 0;
+            allLive = false;
+            if (result == Status::OK) {
+                result = laneStatus;
+            }
+        }
+    }
+    while (leader < Lanes && !live[leader]) {
+        leader++;
+    }
+    tryConverge();
+    return result;
+}
+
+template class Chip8Lockstep<8>;
+template class Chip8Lockstep<16>;
+template class Chip8Lockstep<32>;
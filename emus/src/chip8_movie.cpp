@@ -0,0 +1,135 @@
+#include "chip8_movie.hpp"
+#include "common.hpp"
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t MOVIE_MAGIC = 0x564D3843; // "C8MV" little-endian
+
+// fixed-size fields ahead of the input list
+struct MovieHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed;
+    int32_t instructionsPerFrame;
+    int32_t cpuHz;
+    uint32_t frames;
+    uint64_t romHash;
+    uint32_t inputCount;
+    uint32_t quirks;
+};
+
+// one bit per boolean quirk, the index increment above them
+constexpr uint32_t QUIRK_SHIFT_USES_VY = 1 << 0;
+constexpr uint32_t QUIRK_JUMP_USES_VX = 1 << 1;
+constexpr uint32_t QUIRK_CLIP_SPRITES = 1 << 2;
+constexpr uint32_t QUIRK_LOGIC_RESETS_VF = 1 << 3;
+constexpr uint32_t QUIRK_DISPLAY_WAIT = 1 << 4;
+constexpr uint32_t QUIRK_SUPER_CHIP = 1 << 5;
+constexpr uint32_t QUIRK_XO_CHIP = 1 << 6;
+constexpr int QUIRK_INDEX_INCREMENT_SHIFT = 8;
+constexpr uint32_t QUIRK_KNOWN_BITS = 0x7F | (0x3 << QUIRK_INDEX_INCREMENT_SHIFT);
+
+uint32_t packQuirks(const Chip8::Quirks &quirks) {
+    return (quirks.shiftUsesVY ? QUIRK_SHIFT_USES_VY : 0) |
+           (quirks.jumpUsesVX ? QUIRK_JUMP_USES_VX : 0) |
+           (quirks.clipSprites ? QUIRK_CLIP_SPRITES : 0) |
+           (quirks.logicResetsVF ? QUIRK_LOGIC_RESETS_VF : 0) |
+           (quirks.displayWait ? QUIRK_DISPLAY_WAIT : 0) |
+           (quirks.superChip ? QUIRK_SUPER_CHIP : 0) |
+           (quirks.xoChip ? QUIRK_XO_CHIP : 0) |
+           (static_cast<uint32_t>(quirks.indexIncrement)
+            << QUIRK_INDEX_INCREMENT_SHIFT);
+}
+
+std::optional<Chip8::Quirks> unpackQuirks(uint32_t bits) {
+    const uint32_t increment = (bits >> QUIRK_INDEX_INCREMENT_SHIFT) & 0x3;
+    if ((bits & ~QUIRK_KNOWN_BITS) ||
+        increment > static_cast<uint32_t>(Chip8::IndexIncrement::X_PLUS_1)) {
+        return std::nullopt;
+    }
+    return Chip8::Quirks{
+        .shiftUsesVY = (bits & QUIRK_SHIFT_USES_VY) != 0,
+        .indexIncrement = static_cast<Chip8::IndexIncrement>(increment),
+        .jumpUsesVX = (bits & QUIRK_JUMP_USES_VX) != 0,
+        .clipSprites = (bits & QUIRK_CLIP_SPRITES) != 0,
+        .logicResetsVF = (bits & QUIRK_LOGIC_RESETS_VF) != 0,
+        .displayWait = (bits & QUIRK_DISPLAY_WAIT) != 0,
+        .superChip = (bits & QUIRK_SUPER_CHIP) != 0,
+        .xoChip = (bits & QUIRK_XO_CHIP) != 0,
+    };
+}
+
+// packed to six bytes on disk
+constexpr std::size_t EVENT_SIZE = sizeof(uint32_t) + sizeof(uint16_t);
+
+} // namespace
+
+void Chip8Movie::record(uint32_t frame, uint16_t keyState) {
+    uint16_t previous = inputs.empty() ? 0 : inputs.back().keyState;
+    if (keyState != previous) {
+        inputs.push_back({frame, keyState});
+    }
+}
+
+std::vector<uint8_t> Chip8Movie::serialize() const {
+    MovieHeader header = {
+        .magic = MOVIE_MAGIC,
+        .version = VERSION,
+        .seed = seed,
+        .instructionsPerFrame = instructionsPerFrame,
+        .cpuHz = cpuHz,
+        .frames = frames,
+        .romHash = romHash,
+        .inputCount = static_cast<uint32_t>(inputs.size()),
+        .quirks = packQuirks(quirks),
+    };
+    std::vector<uint8_t> data(sizeof(header) + inputs.size() * EVENT_SIZE);
+    memcpy(data.data(), &header, sizeof(header));
+    uint8_t *out = data.data() + sizeof(header);
+    for (const auto &event : inputs) {
+        memcpy(out, &event.frame, sizeof(event.frame));
+        memcpy(out + sizeof(event.frame), &event.keyState,
+               sizeof(event.keyState));
+        out += EVENT_SIZE;
+    }
+    return data;
+}
+
+std::optional<Chip8Movie>
+Chip8Movie::deserialize(std::span<const uint8_t> data) {
+    MovieHeader header;
+    if (data.size() < sizeof(header)) {
+        return std::nullopt;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != MOVIE_MAGIC || header.version != VERSION ||
+        data.size() != sizeof(header) + header.inputCount * EVENT_SIZE) {
+        return std::nullopt;
+    }
+    auto quirks = unpackQuirks(header.quirks);
+    if (!quirks) {
+        return std::nullopt;
+    }
+
+    Chip8Movie movie;
+    movie.seed = header.seed;
+    movie.quirks = *quirks;
+    movie.instructionsPerFrame = header.instructionsPerFrame;
+    movie.cpuHz = header.cpuHz;
+    movie.frames = header.frames;
+    movie.romHash = header.romHash;
+    movie.inputs.resize(header.inputCount);
+    const uint8_t *in = data.data() + sizeof(header);
+    for (auto &event : movie.inputs) {
+        memcpy(&event.frame, in, sizeof(event.frame));
+        memcpy(&event.keyState, in + sizeof(event.frame),
+               sizeof(event.keyState));
+        in += EVENT_SIZE;
+    }
+    return movie;
+}
+
+uint64_t Chip8Movie::hashRom(std::span<const uint8_t> rom) {
+    return fnv1a(rom);
+}
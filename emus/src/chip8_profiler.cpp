@@ -0,0 +1,245 @@
+#include "chip8_profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+namespace {
+constexpr std::string_view OPCODE_NAMES[] = {
+    "00E0", "00EE", "1NNN", "2NNN", "3XKK", "4XKK", "5XY0",
+    "6XKK", "7XKK", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4",
+    "8XY5", "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN",
+    "CXKK", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15",
+    "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65", "00CN",
+    "00FB", "00FC", "00FD", "00FE", "00FF", "FX30", "FX75",
+    "FX85", "00DN", "5XY2", "5XY3", "F000", "FX01", "F002",
+    "FX3A", "invalid",
+};
+static_assert(std::size(OPCODE_NAMES) ==
+              static_cast<int>(Chip8Profiler::OpcodeClass::COUNT));
+
+std::string formatAddress(uint16_t address) {
+    char name[8];
+    snprintf(name, sizeof(name), "0x%03X", address);
+    return name;
+}
+} // namespace
+
+Chip8Profiler::OpcodeClass Chip8Profiler::classify(uint16_t instruction) {
+    using enum OpcodeClass;
+    const uint8_t n = instruction & 0x000F;
+    const uint8_t kk = instruction & 0x00FF;
+    switch (instruction >> 12) {
+    case 0x0:
+        // SUPER-CHIP and XO-CHIP ones are counted even when the quirks
+        // decode them as invalid
+        if ((instruction & 0xFFF0) == 0x00C0) {
+            return OP_00CN;
+        } else if ((instruction & 0xFFF0) == 0x00D0) {
+            return OP_00DN;
+        }
+        switch (instruction) {
+        case 0x00E0:
+            return OP_00E0;
+        case 0x00EE:
+            return OP_00EE;
+        case 0x00FB:
+            return OP_00FB;
+        case 0x00FC:
+            return OP_00FC;
+        case 0x00FD:
+            return OP_00FD;
+        case 0x00FE:
+            return OP_00FE;
+        case 0x00FF:
+            return OP_00FF;
+        default:
+            return INVALID;
+        }
+    case 0x1:
+        return OP_1NNN;
+    case 0x2:
+        return OP_2NNN;
+    case 0x3:
+        return OP_3XKK;
+    case 0x4:
+        return OP_4XKK;
+    case 0x5:
+        return n == 2 ? OP_5XY2 : n == 3 ? OP_5XY3 : OP_5XY0;
+    case 0x6:
+        return OP_6XKK;
+    case 0x7:
+        return OP_7XKK;
+    case 0x8:
+        if (n <= 7) {
+            return static_cast<OpcodeClass>(static_cast<int>(OP_8XY0) + n);
+        }
+        return n == 0xE ? OP_8XYE : INVALID;
+    case 0x9:
+        return OP_9XY0;
+    case 0xA:
+        return OP_ANNN;
+    case 0xB:
+        return OP_BNNN;
+    case 0xC:
+        return OP_CXKK;
+    case 0xD:
+        return OP_DXYN;
+    case 0xE:
+        return kk == 0x9E ? OP_EX9E : kk == 0xA1 ? OP_EXA1 : INVALID;
+    default:
+        switch (kk) {
+        case 0x00:
+            return OP_F000;
+        case 0x01:
+            return OP_FX01;
+        case 0x02:
+            return OP_F002;
+        case 0x07:
+            return OP_FX07;
+        case 0x0A:
+            return OP_FX0A;
+        case 0x15:
+            return OP_FX15;
+        case 0x18:
+            return OP_FX18;
+        case 0x1E:
+            return OP_FX1E;
+        case 0x29:
+            return OP_FX29;
+        case 0x30:
+            return OP_FX30;
+        case 0x33:
+            return OP_FX33;
+        case 0x3A:
+            return OP_FX3A;
+        case 0x55:
+            return OP_FX55;
+        case 0x65:
+            return OP_FX65;
+        case 0x75:
+            return OP_FX75;
+        case 0x85:
+            return OP_FX85;
+        default:
+            return INVALID;
+        }
+    }
+}
+
+std::string_view Chip8Profiler::getName(OpcodeClass opcodeClass) {
+    return OPCODE_NAMES[static_cast<int>(opcodeClass)];
+}
+
+Chip8Profiler::Chip8Profiler() { clear(); }
+
+void Chip8Profiler::clear() {
+    opcodeCounts.fill(0);
+    pcCounts.assign(ADDRESS_COUNT, 0);
+    keyWaitCycles = 0;
+    draws = 0;
+    collisions = 0;
+    stackNodes.assign(1, {0, 0});
+    stackCounts.assign(1, 0);
+    stackChildren.clear();
+    currentStack = 0;
+}
+
+uint32_t Chip8Profiler::childOf(uint32_t parent, uint16_t entry) {
+    auto [it, inserted] = stackChildren.try_emplace(
+        {parent, entry}, static_cast<uint32_t>(stackNodes.size()));
+    if (inserted) {
+        stackNodes.push_back({parent, entry});
+        stackCounts.push_back(0);
+    }
+    return it->second;
+}
+
+void Chip8Profiler::onStackChange(std::span<const uint8_t> stack,
+                                  std::span<const uint8_t> memory) {
+    uint32_t node = 0;
+    for (std::size_t i = 0; i + 1 < stack.size(); i += 2) {
+        const uint16_t callSite = (stack[i] << 8 | stack[i + 1]) &
+                                  (ADDRESS_COUNT - 1);
+        uint16_t entry = callSite;
+        if (callSite + 1u < memory.size() && memory[callSite] >> 4 == 0x2) {
+            entry = (memory[callSite] & 0xF) << 8 | memory[callSite + 1];
+        }
+        node = childOf(node, entry);
+    }
+    currentStack = node;
+}
+
+uint64_t Chip8Profiler::getInstructions() const {
+    return std::accumulate(opcodeCounts.begin(), opcodeCounts.end(),
+                           uint64_t{0});
+}
+
+std::string Chip8Profiler::report(int topPcs) const {
+    const uint64_t total = getInstructions();
+    const double scale = total ? 100.0 / total : 0.0;
+    std::string out;
+    char line[160];
+
+    snprintf(line, sizeof(line), "Instructions: %llu\n",
+             static_cast<unsigned long long>(total));
+    out += line;
+    std::vector<int> classes(opcodeCounts.size());
+    std::iota(classes.begin(), classes.end(), 0);
+    std::stable_sort(classes.begin(), classes.end(), [&](int a, int b) {
+        return opcodeCounts[a] > opcodeCounts[b];
+    });
+    out += "Opcode       count      %\n";
+    for (int opcodeClass : classes) {
+        if (!opcodeCounts[opcodeClass]) {
+            break;
+        }
+        snprintf(line, sizeof(line), "%-7s %10llu %6.2f\n",
+                 OPCODE_NAMES[opcodeClass].data(),
+                 static_cast<unsigned long long>(opcodeCounts[opcodeClass]),
+                 opcodeCounts[opcodeClass] * scale);
+        out += line;
+    }
+
+    std::vector<uint16_t> pcs(ADDRESS_COUNT);
+    std::iota(pcs.begin(), pcs.end(), 0);
+    std::stable_sort(pcs.begin(), pcs.end(), [&](uint16_t a, uint16_t b) {
+        return pcCounts[a] > pcCounts[b];
+    });
+    out += "PC           count      %\n";
+    for (int i = 0; i < std::min(topPcs, ADDRESS_COUNT) && pcCounts[pcs[i]];
+         i++) {
+        snprintf(line, sizeof(line), "%-7s %10llu %6.2f\n",
+                 formatAddress(pcs[i]).c_str(),
+                 static_cast<unsigned long long>(pcCounts[pcs[i]]),
+                 pcCounts[pcs[i]] * scale);
+        out += line;
+    }
+
+    snprintf(line, sizeof(line),
+             "FX0A wait cycles: %llu\nDXYN draws: %llu, collisions: %llu\n",
+             static_cast<unsigned long long>(keyWaitCycles),
+             static_cast<unsigned long long>(draws),
+             static_cast<unsigned long long>(collisions));
+    out += line;
+    return out;
+}
+
+std::string Chip8Profiler::foldedStacks() const {
+    std::string out;
+    std::vector<uint16_t> path;
+    for (uint32_t node = 0; node < stackNodes.size(); node++) {
+        if (!stackCounts[node]) {
+            continue;
+        }
+        path.clear();
+        for (uint32_t at = node; at != 0; at = stackNodes[at].parent) {
+            path.push_back(stackNodes[at].entry);
+        }
+        out += "main";
+        for (auto entry = path.rbegin(); entry != path.rend(); entry++) {
+            out += ";sub_" + formatAddress(*entry);
+        }
+        out += " " + std::to_string(stackCounts[node]) + "\n";
+    }
+    return out;
+}
@@ -0,0 +1,150 @@
+#include "chip8_rewind.hpp"
+#include <algorithm>
+#include <cstring>
+
+Chip8Rewind::Chip8Rewind(int maxFrames, std::size_t capacityBytes)
+    : maxRecords(std::max(maxFrames - 1, 1)),
+      arena(std::max(capacityBytes, MAX_ENCODED_SIZE)), records(maxRecords),
+      newestState(STATE_SIZE), scratchState(STATE_SIZE),
+      scratchRecord(MAX_ENCODED_SIZE), snapshot() {}
+
+std::size_t Chip8Rewind::encode(std::span<const uint8_t> state,
+                                std::span<const uint8_t> base,
+                                std::span<uint8_t> out) {
+    const std::size_t size = state.size();
+    std::size_t in = 0;
+    std::size_t written = 0;
+    while (in < size) {
+        std::size_t zeros = 0;
+        while (in + zeros < size && state[in + zeros] == base[in + zeros]) {
+            zeros++;
+        }
+        in += zeros;
+        if (in == size) {
+            // trailing unchanged bytes need no segment
+            break;
+        }
+
+        // extend the literal until a zero run long enough to pay for a
+        // new segment header
+        std::size_t literal = 0;
+        std::size_t run = 0;
+        while (in + literal + run < size && run < SEGMENT_HEADER_SIZE) {
+            if (state[in + literal + run] == base[in + literal + run]) {
+                run++;
+            } else {
+                literal += run + 1;
+                run = 0;
+            }
+        }
+
+        uint32_t header[2] = {static_cast<uint32_t>(zeros),
+                              static_cast<uint32_t>(literal)};
+        memcpy(&out[written], header, SEGMENT_HEADER_SIZE);
+        written += SEGMENT_HEADER_SIZE;
+        for (std::size_t i = 0; i < literal; i++) {
+            out[written + i] = state[in + i] ^ base[in + i];
+        }
+        written += literal;
+        in += literal;
+    }
+    return written;
+}
+
+void Chip8Rewind::decode(std::span<const uint8_t> record,
+                         std::span<uint8_t> state) {
+    std::size_t in = 0;
+    std::size_t out = 0;
+    while (in < record.size()) {
+        uint32_t header[2];
+        memcpy(header, &record[in], SEGMENT_HEADER_SIZE);
+        in += SEGMENT_HEADER_SIZE;
+        out += header[0];
+        for (std::size_t i = 0; i < header[1]; i++) {
+            state[out + i] ^= record[in + i];
+        }
+        in += header[1];
+        out += header[1];
+    }
+}
+
+void Chip8Rewind::evictOldest() {
+    bytesUsed -= records[recordHead].size;
+    recordHead = (recordHead + 1) % maxRecords;
+    recordCount--;
+    if (recordCount == 0) {
+        writeOffset = 0;
+    }
+}
+
+std::size_t Chip8Rewind::reserve(std::size_t size) {
+    if (recordCount == maxRecords) {
+        evictOldest();
+    }
+    while (recordCount > 0) {
+        const std::size_t oldest = records[recordHead].offset;
+        if (writeOffset > oldest) {
+            // live bytes are [oldest, writeOffset); try the end, then wrap
+            if (size <= arena.size() - writeOffset) {
+                return writeOffset;
+            }
+            if (size <= oldest) {
+                return 0;
+            }
+        } else if (writeOffset < oldest && size <= oldest - writeOffset) {
+            // wrapped: the free bytes are [writeOffset, oldest)
+            return writeOffset;
+        }
+        evictOldest();
+    }
+    return 0;
+}
+
+void Chip8Rewind::push(const Chip8 &emulator) {
+    emulator.saveState(snapshot);
+    memcpy(scratchState.data(), &snapshot, STATE_SIZE);
+
+    if (hasNewest) {
+        // the previous frame becomes a delta against this one
+        const std::size_t size =
+            encode(newestState, scratchState, scratchRecord);
+        const std::size_t offset = reserve(size);
+        memcpy(&arena[offset], scratchRecord.data(), size);
+        writeOffset = offset + size;
+        bytesUsed += size;
+        records[(recordHead + recordCount) % maxRecords] = {
+            .offset = offset,
+            .size = static_cast<uint32_t>(size),
+        };
+        recordCount++;
+    }
+    newestState.swap(scratchState);
+    hasNewest = true;
+}
+
+bool Chip8Rewind::stepBack(Chip8 &emulator) {
+    if (recordCount == 0) {
+        return false;
+    }
+    const Record &newest =
+        records[(recordHead + recordCount - 1) % maxRecords];
+    decode(std::span(arena).subspan(newest.offset, newest.size), newestState);
+    bytesUsed -= newest.size;
+    writeOffset = newest.offset;
+    recordCount--;
+    if (recordCount == 0) {
+        writeOffset = 0;
+    }
+
+    memcpy(&snapshot, newestState.data(), STATE_SIZE);
+    emulator.loadState(snapshot);
+    return true;
+}
+
+void Chip8Rewind::clear() {
+    recordHead = 0;
+    recordCount = 0;
+    writeOffset = 0;
+    bytesUsed = 0;
+    hasNewest = false;
+}
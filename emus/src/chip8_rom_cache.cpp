@@ -0,0 +1,168 @@
+#include "chip8_rom_cache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t ARCHIVE_MAGIC = 0x41523843; // "C8RA" little-endian
+constexpr uint32_t ARCHIVE_VERSION = 1;
+
+struct ArchiveHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+// offsets are from the start of the archive
+struct ArchiveEntry {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t imageOffset;
+    uint32_t imageSize;
+};
+
+bool inBounds(std::size_t size, uint32_t offset, uint32_t length) {
+    return offset <= size && length <= size - offset;
+}
+
+} // namespace
+
+void Chip8RomCache::Unmap::operator()(const uint8_t *address) const {
+    munmap(const_cast<uint8_t *>(address), length);
+}
+
+std::optional<Chip8RomCache>
+Chip8RomCache::open(const std::filesystem::path &path) {
+    Chip8RomCache cache;
+    std::error_code error;
+    if (std::filesystem::is_directory(path, error)) {
+        std::vector<std::filesystem::path> files;
+        for (const auto &entry :
+             std::filesystem::directory_iterator(path, error)) {
+            if (entry.is_regular_file(error)) {
+                files.push_back(entry.path());
+            }
+        }
+        if (error) {
+            return std::nullopt;
+        }
+        std::ranges::sort(files);
+        for (const auto &file : files) {
+            if (!cache.add(file)) {
+                return std::nullopt;
+            }
+        }
+        return cache;
+    }
+    if (!cache.add(path)) {
+        return std::nullopt;
+    }
+    return cache;
+}
+
+bool Chip8RomCache::add(const std::filesystem::path &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return false;
+    }
+    const auto size = static_cast<std::size_t>(info.st_size);
+    if (size == 0) {
+        // nothing to map, but still a (useless) ROM
+        close(fd);
+        entries.push_back({path.string(), {}});
+        return true;
+    }
+    void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+    const auto &mapping = mappings.emplace_back(
+        static_cast<const uint8_t *>(address), Unmap{size});
+    std::span<const uint8_t> data(mapping.get(), size);
+
+    ArchiveHeader header;
+    if (size < sizeof(header)) {
+        entries.push_back({path.string(), data});
+        return true;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != ARCHIVE_MAGIC) {
+        entries.push_back({path.string(), data});
+        return true;
+    }
+    if (header.version != ARCHIVE_VERSION ||
+        header.count > (size - sizeof(header)) / sizeof(ArchiveEntry)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header.count; i++) {
+        ArchiveEntry entry;
+        memcpy(&entry, data.data() + sizeof(header) + i * sizeof(entry),
+               sizeof(entry));
+        if (!inBounds(size, entry.nameOffset, entry.nameLength) ||
+            !inBounds(size, entry.imageOffset, entry.imageSize)) {
+            return false;
+        }
+        entries.push_back({
+            std::string(reinterpret_cast<const char *>(data.data()) +
+                            entry.nameOffset,
+                        entry.nameLength),
+            data.subspan(entry.imageOffset, entry.imageSize),
+        });
+    }
+    return true;
+}
+
+const Chip8RomCache::Rom *Chip8RomCache::find(std::string_view name) const {
+    auto rom = std::ranges::find(entries, name, &Rom::name);
+    return rom == entries.end() ? nullptr : &*rom;
+}
+
+std::vector<uint8_t> Chip8RomCache::pack(std::span<const Rom> roms) {
+    ArchiveHeader header = {
+        .magic = ARCHIVE_MAGIC,
+        .version = ARCHIVE_VERSION,
+        .count = static_cast<uint32_t>(roms.size()),
+        .reserved = 0,
+    };
+    std::size_t size = sizeof(header) + roms.size() * sizeof(ArchiveEntry);
+    for (const auto &rom : roms) {
+        size += rom.name.size() + rom.image.size();
+    }
+    std::vector<uint8_t> data(size);
+    memcpy(data.data(), &header, sizeof(header));
+
+    // names and images follow the table, each ROM's name ahead of it
+    auto offset = static_cast<uint32_t>(sizeof(header) +
+                                        roms.size() * sizeof(ArchiveEntry));
+    for (std::size_t i = 0; i < roms.size(); i++) {
+        const auto &rom = roms[i];
+        ArchiveEntry entry = {
+            .nameOffset = offset,
+            .nameLength = static_cast<uint32_t>(rom.name.size()),
+            .imageOffset = static_cast<uint32_t>(offset + rom.name.size()),
+            .imageSize = static_cast<uint32_t>(rom.image.size()),
+        };
+        memcpy(data.data() + sizeof(header) + i * sizeof(entry), &entry,
+               sizeof(entry));
+        memcpy(data.data() + entry.nameOffset, rom.name.data(),
+               rom.name.size());
+        if (!rom.image.empty()) {
+            memcpy(data.data() + entry.imageOffset, rom.image.data(),
+                   rom.image.size());
+        }
+        offset = entry.imageOffset + entry.imageSize;
+    }
+    return data;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "common.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// One display byte expanded to its eight RGBA8888 pixels, MSB first.
+inline constexpr auto chip8ExpandedBytes = [] {
+    std::array<std::array<uint32_t, BITS_PER_BYTE>, 256> table = {};
+    for (int value = 0; value < 256; value++) {
+        for (int bit = 0; bit < BITS_PER_BYTE; bit++) {
+            table[value][bit] = (value >> (7 - bit)) & 1 ? 0xFFFFFFFF : 0;
+        }
+    }
+    return table;
+}();
+
+// Expands 1bpp display bytes into `pixels`, eight per byte. No SDL here so
+// the benchmarks can link it without a window.
+inline void expandDisplayBytes(std::span<const uint8_t> bytes,
+                               uint32_t *pixels) {
+    for (std::size_t i = 0; i < bytes.size(); i++) {
+        memcpy(&pixels[i * BITS_PER_BYTE], chip8ExpandedBytes[bytes[i]].data(),
+               BITS_PER_BYTE * sizeof(uint32_t));
+    }
+}
+
+// XO-CHIP's colours by plane bits: off, first plane, second plane, both.
+// The first plane alone looks like the 1bpp expansion.
+inline constexpr std::array<uint32_t, 4> chip8PlanePalette = {
+    0x00000000,
+    0xFFFFFFFF,
+    0xFF8000FF,
+    0x804000FF,
+};
+
+// Expands two 1bpp planes of the same size into `pixels` through
+// chip8PlanePalette.
+inline void expandDisplayPlanes(std::span<const uint8_t> first,
+                                std::span<const uint8_t> second,
+                                uint32_t *pixels) {
+    for (std::size_t i = 0; i < first.size(); i++) {
+        for (int bit = 0; bit < BITS_PER_BYTE; bit++) {
+            const int shift = 7 - bit;
+            pixels[i * BITS_PER_BYTE + bit] =
+                chip8PlanePalette[(first[i] >> shift & 1) |
+                                  (second[i] >> shift & 1) << 1];
+        }
+    }
+}
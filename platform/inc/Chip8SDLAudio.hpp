@@ -1,27 +1,76 @@
 #pragma once
+#include "spsc_ring.hpp"
 #include <SDL3/SDL_audio.h>
-#include <cmath>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <span>
 
+// The beep, rendered on SDL's audio thread. The emulation side only pushes
+// on/off edges stamped in emulated samples; the callback gates a square
+// wave read from a one-period table, so beeps start and stop on the sample
+// they were due instead of on the next frame. Once an XO-CHIP program sets
+// a pattern, that plays instead of the square wave.
 class Chip8Audio {
   public:
+    static constexpr int SAMPLE_RATE = 44100;
+
     Chip8Audio();
     ~Chip8Audio();
 
-    void play();
-    void stop();
-    bool isPlaying() const { return playing; }
-    void update();
+    // From the one thread running the emulator. `sample` is emulated time,
+    // SAMPLE_RATE per emulated second; edges must come in order.
+    void push(uint64_t sample, bool on);
+    // XO-CHIP's 128 one-bit samples, MSB first, played at `rate` bits per
+    // second. From the emulator thread too; it takes effect on the next
+    // chunk rather than at an exact sample.
+    void setPattern(std::span<const uint8_t, 16> pattern, double rate);
+
+    // fills `buffer` with the beep, advancing the fixed-point `phase`
+    // across calls
+    static void generateSquareWave(float *buffer, int samples,
+                                   uint32_t &phase);
+    // the same from a pattern whose 128 bits span one 2^32 phase period
+    static void generatePattern(float *buffer, int samples, uint32_t &phase,
+                                const std::array<uint64_t, 2> &pattern,
+                                uint32_t phaseIncrement);
 
   private:
-    SDL_AudioStream *stream = nullptr;
-    bool playing = false;
+    struct Edge {
+        uint64_t sample;
+        bool on;
+    };
+
+    static void SDLCALL feed(void *userdata, SDL_AudioStream *stream,
+                             int additionalAmount, int totalAmount);
+    void render(int samples);
+    // audio time the next edge is due at, resyncing if the emulator has
+    // drifted too far from the audio clock
+    void syncTo(const Edge &edge);
 
-    static constexpr int SAMPLE_RATE = 44100;
     static constexpr int FREQUENCY = 440;
     static constexpr float AMPLITUDE = 0.1f;
-    static constexpr int BUFFER_SIZE = 4096;
-    static constexpr int MIN_QUEUED_BYTES = 2048;
+    static constexpr int CHUNK_SAMPLES = 512;
+    static constexpr int EDGE_CAPACITY = 256;
+    // edges play this far behind the emulator, two frames, to absorb
+    // frame pacing jitter
+    static constexpr int LATENCY_SAMPLES = SAMPLE_RATE / 30;
+    // beyond this the clocks are resynced rather than caught up
+    static constexpr int MAX_DRIFT_SAMPLES = SAMPLE_RATE / 4;
+
+    SDL_AudioStream *stream = nullptr;
+    SpscRing<Edge, EDGE_CAPACITY> edges;
+    // the pattern packed big-endian and its phase step; zero until set.
+    // The words may tear for a chunk while the emulator rewrites them.
+    std::array<std::atomic<uint64_t>, 2> patternWords = {};
+    std::atomic<uint32_t> patternIncrement = 0;
 
-    float phase = 0.0f;
-    void generateSquareWave(float *buffer, int samples);
+    // audio thread only
+    std::array<float, CHUNK_SAMPLES> chunk = {};
+    Edge pending = {};
+    bool hasPending = false;
+    bool synced = false;
+    bool gate = false;
+    uint64_t clock = 0;
+    uint32_t phase = 0;
 };
@@ -1,12 +1,23 @@
 #pragma once
 #include "Chip8SDLAudio.hpp"
+#include "FramePacer.hpp"
 #include "SDL3/SDL_render.h"
 #include "SDL3/SDL_video.h"
 #include "chip8.hpp"
+#include "chip8_capture.hpp"
+#include "chip8_movie.hpp"
+#include "chip8_rewind.hpp"
+#include "spsc_ring.hpp"
+#include "triple_buffer.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cassert>
 #include <cstdint>
 #include <expected>
+#include <optional>
 #include <span>
+#include <stop_token>
 #include <sys/types.h>
 #include <vector>
 
@@ -15,11 +26,38 @@ enum class DisplayStatus {
     DISPLAY_ERROR,
 };
 
+enum class SpeedMode {
+    // one emulated frame per 60 Hz host frame
+    REAL_TIME,
+    // fastForwardFactor emulated frames per host frame, last one drawn
+    FAST_FORWARD,
+    // emulated frames back to back, drawn at the host frame rate
+    UNCAPPED,
+};
+
 class Chip8SDLPlatform {
   public:
     struct Config {
         int displayScale;
         int instructionsPerFrame;
+        // run the core on its own thread so rendering cannot stall it
+        bool threaded = false;
+        // switchable at runtime with F1/F2/F3
+        SpeedMode speedMode = SpeedMode::REAL_TIME;
+        int fastForwardFactor = 4;
+        // when set, instructions per frame follow this emulated clock
+        // instead of instructionsPerFrame
+        int cpuHz = 0;
+        // history kept for hold-Backspace rewind, 0 to disable; never
+        // used while recording or replaying a movie
+        int rewindSeconds = 10;
+        std::size_t rewindBytes = 8 << 20;
+        // keypad changes are appended here every frame when set
+        Chip8Movie *recording = nullptr;
+        // keypad comes from here instead of the keyboard when set
+        const Chip8Movie *replay = nullptr;
+        // every frame shown, rewound ones included, is handed to it when set
+        Chip8CaptureWriter *capture = nullptr;
     };
 
     Chip8SDLPlatform(const Config &config);
@@ -27,18 +65,80 @@ class Chip8SDLPlatform {
     ~Chip8SDLPlatform();
 
     void run(Chip8 &emulator);
-    DisplayStatus render(std::span<const uint8_t> chip8DisplayBuf);
+    // Re-expands and uploads only the rows set in `dirtyRows` and skips the
+    // present entirely when none are. A resolution change, SUPER-CHIP's
+    // 00FE/00FF, swaps the texture and redraws everything. XO-CHIP passes
+    // its second plane too, and the two are drawn in four colours.
+    DisplayStatus render(std::span<const uint8_t> chip8DisplayBuf, int width,
+                         int height, uint32_t dirtyRows,
+                         std::span<const uint8_t> secondPlane = {});
     void handleEvents(Chip8 &emulator, bool &quit);
     std::expected<int, Chip8::Status> mapSDLToChip8(SDL_Scancode code);
+    static std::optional<SpeedMode> mapSDLToSpeedMode(SDL_Scancode code);
 
   private:
+    // what the emulation thread hands the renderer once per frame
+    struct Frame {
+        std::array<uint8_t, Chip8::Chip8Hardware::HIRES_DISPLAY_SIZE> display;
+        // XO-CHIP only
+        std::array<uint8_t, Chip8::Chip8Hardware::HIRES_DISPLAY_SIZE>
+            secondPlane;
+        bool hasSecondPlane;
+        int width;
+        int height;
+    };
+    struct KeyEvent {
+        uint8_t chip8code;
+        bool down;
+    };
+    static constexpr int KEY_EVENT_CAPACITY = 64;
+    // frames run back to back after a stall before the rest are dropped
+    static constexpr int MAX_CATCH_UP_FRAMES = 4;
+
+    void runSerial(Chip8 &emulator);
+    void runThreaded(Chip8 &emulator);
+    void emulate(Chip8 &emulator, std::stop_token stop);
+    template <typename KeySink> void pollEvents(KeySink &&onKey, bool &quit);
+    void logStats(const FramePacer::Stats &stats) const;
+    // Runs the emulated frames owed for one host frame in the current mode,
+    // or steps one frame back while rewind is held.
+    void runFrames(Chip8 &emulator, const FramePacer &pacer, int framesDue);
+    void runFrame(Chip8 &emulator);
+    int nextInstructionBudget();
+    // Hands the core's beep edges to the audio thread, each placed within
+    // the current frame by its share of the frame's instruction budget,
+    // along with XO-CHIP's pattern and pitch.
+    void pushSoundEvents(Chip8 &emulator, uint64_t frameStart, int budget);
+    void resizeTexture(int width, int height);
+
     Chip8Audio audio;
 
     SDL_Window *window;
     SDL_Renderer *renderer;
-    SDL_Texture *texture;
+    SDL_Texture *texture = nullptr;
+    int textureWidth = 0;
+    int textureHeight = 0;
 
     const Config config;
+    // written by the event loop, read by the emulation thread
+    std::atomic<SpeedMode> speedMode;
+    // cpuHz cycles not yet handed out, in 1/TARGET_FPS instructions
+    int cycleCarry = 0;
+    // owned by whichever thread runs the emulator; empty when rewindSeconds
+    // is 0, so a disabled rewind allocates nothing and snapshots no frames
+    std::optional<Chip8Rewind> rewind;
+    std::atomic<bool> rewinding = false;
+    // emulated frames run so far, the movie's time base
+    uint32_t frameNumber = 0;
+    Chip8InputPlayback playback;
 
     std::vector<uint32_t> pixelBuffer;
+    // set when the window needs repainting regardless of the display
+    bool forceRedraw = true;
+
+    // threaded mode only: frames flow to the renderer, keys to the core
+    TripleBuffer<Frame> frames;
+    // bumped after every publish; the render loop sleeps on it
+    std::atomic<uint32_t> framesPublished = 0;
+    SpscRing<KeyEvent, KEY_EVENT_CAPACITY> keyEvents;
 };
@@ -0,0 +1,51 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Paces a loop to a fixed frame rate on steady_clock nanoseconds. The
+// period's fractional nanoseconds are carried from frame to frame, so 60 Hz
+// stays 60 Hz over any run length instead of rounding to whole milliseconds.
+// Waiting sleeps until shortly before the deadline and spins the rest.
+class FramePacer {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        int64_t waits = 0;
+        // frames given up on after a stall longer than the catch-up limit
+        int64_t dropped = 0;
+        // how late each wait returned relative to its deadline
+        std::chrono::nanoseconds totalJitter{0};
+        std::chrono::nanoseconds maxJitter{0};
+
+        std::chrono::nanoseconds meanJitter() const {
+            return waits ? totalJitter / waits : std::chrono::nanoseconds{0};
+        }
+    };
+
+    // maxCatchUpFrames bounds how many overdue frames one wait() reports
+    FramePacer(int framesPerSecond, int maxCatchUpFrames);
+
+    // Blocks until the next frame is due and returns how many frames the
+    // caller should run: 1 when on time, more to catch up after a stall.
+    int wait();
+    // true once the next deadline has passed, without blocking
+    bool isDue() const { return Clock::now() >= deadline; }
+    const Stats &getStats() const { return stats; }
+
+  private:
+    // sleeps overshoot by up to about this much, so the tail is spun
+    static constexpr std::chrono::nanoseconds SPIN_THRESHOLD =
+        std::chrono::microseconds(1000);
+
+    void advance();
+
+    const int framesPerSecond;
+    const int maxCatchUpFrames;
+    const std::chrono::nanoseconds period;
+    // leftover of one second / framesPerSecond, in 1/framesPerSecond ns
+    const int64_t periodRemainder;
+    int64_t remainderCarry = 0;
+    Clock::time_point deadline;
+    Stats stats;
+};
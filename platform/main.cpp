@@ -1,43 +1,170 @@
 #include "Chip8SDLPlatform.hpp"
 #include "chip8.hpp"
+#include "chip8_capture.hpp"
+#include "chip8_movie.hpp"
+#include "chip8_rom_cache.hpp"
 #include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
 #include <vector>
 
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        printf("Usage: %s <program_path> <instructions per update>\n", argv[0]);
+        printf("Usage: %s <program_path> <instructions per update> [options]\n"
+               "  --threaded          run the core on its own thread\n"
+               "  --fast-forward <n>  start in fast-forward at n frames per "
+               "frame\n"
+               "  --uncapped          start with no speed limit\n"
+               "  --hz <n>            emulate an n Hz CPU instead of a fixed "
+               "count\n"
+               "  --quirks <name>     modern (default), vip, chip48, schip\n"
+               "                      or xochip\n"
+               "  --seed <n>          seed the RNG for a reproducible run\n"
+               "  --record <file>     write an input movie on exit\n"
+               "  --replay <file>     play back an input movie\n"
+               "  --capture <file>    record every frame's display losslessly\n"
+               "F1/F2/F3 switch between real time, fast-forward and uncapped.\n",
+               argv[0]);
         return 1;
     }
 
     std::filesystem::path romPath = argv[1];
-    int instructionsPerUpdate = std::stoi(argv[2]);
-    if (!std::filesystem::exists(romPath) ||
-        !std::filesystem::is_regular_file(romPath)) {
+    Chip8SDLPlatform::Config chip8Config = {
+        .displayScale = 10,
+        .instructionsPerFrame = std::stoi(argv[2]),
+    };
+    std::optional<uint32_t> seed;
+    std::optional<std::filesystem::path> recordPath;
+    std::optional<std::filesystem::path> replayPath;
+    std::optional<std::filesystem::path> capturePath;
+    // unset means modern, or whatever a replayed movie was recorded with
+    std::optional<Chip8::Quirks> quirks;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threaded") {
+            chip8Config.threaded = true;
+        } else if (arg == "--uncapped") {
+            chip8Config.speedMode = SpeedMode::UNCAPPED;
+        } else if (i + 1 < argc && arg == "--fast-forward") {
+            chip8Config.speedMode = SpeedMode::FAST_FORWARD;
+            chip8Config.fastForwardFactor = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--hz") {
+            chip8Config.cpuHz = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--quirks") {
+            auto preset = Chip8::findQuirks(argv[++i]);
+            if (!preset) {
+                std::cerr << "Unknown quirks:" << argv[i] << "\n";
+                return 1;
+            }
+            quirks = *preset;
+        } else if (i + 1 < argc && arg == "--seed") {
+            seed = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--record") {
+            recordPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--replay") {
+            replayPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--capture") {
+            capturePath = argv[++i];
+        } else {
+            std::cerr << "Unknown option:" << arg << "\n";
+            return 1;
+        }
+    }
+    if (!std::filesystem::is_regular_file(romPath)) {
         std::cerr << "File does not exist or is not a regular file:" << romPath
                   << "\n";
         return 1;
     }
-    std::ifstream rom(romPath, std::ios::in | std::ios::binary);
-    if (rom.fail()) {
-        std::cerr << "Failed to open file:" << romPath.c_str() << "\n";
+    auto romCache = Chip8RomCache::open(romPath);
+    if (!romCache || romCache->roms().size() != 1) {
+        std::cerr << "Not a single ROM:" << romPath << "\n";
         return 1;
     }
+    const auto romImage = romCache->roms().front().image;
 
-    std::vector<uint8_t> romBuffer((std::istreambuf_iterator<char>(rom)),
-                                   std::istreambuf_iterator<char>());
-    rom.close();
+    Chip8Movie movie;
+    if (replayPath) {
+        std::ifstream movieFile(*replayPath, std::ios::in | std::ios::binary);
+        std::vector<uint8_t> movieBuffer(
+            (std::istreambuf_iterator<char>(movieFile)),
+            std::istreambuf_iterator<char>());
+        auto loaded = Chip8Movie::deserialize(movieBuffer);
+        if (!loaded) {
+            std::cerr << "Not a usable input movie:" << *replayPath << "\n";
+            return 1;
+        }
+        movie = std::move(*loaded);
+        if (movie.romHash != Chip8Movie::hashRom(romImage)) {
+            std::cerr << "Movie was recorded with a different ROM\n";
+            return 1;
+        }
+        if (quirks && *quirks != movie.quirks) {
+            std::cerr << "Movie was recorded with different quirks\n";
+            return 1;
+        }
+        seed = movie.seed;
+        quirks = movie.quirks;
+        chip8Config.instructionsPerFrame = movie.instructionsPerFrame;
+        chip8Config.cpuHz = movie.cpuHz;
+        chip8Config.replay = &movie;
+    } else if (recordPath) {
+        movie.seed = seed.value_or(std::random_device{}());
+        seed = movie.seed;
+        movie.quirks = quirks.value_or(Chip8::MODERN_QUIRKS);
+        movie.instructionsPerFrame = chip8Config.instructionsPerFrame;
+        movie.cpuHz = chip8Config.cpuHz;
+        movie.romHash = Chip8Movie::hashRom(romImage);
+        chip8Config.recording = &movie;
+    }
+    if (replayPath || recordPath) {
+        // rewinding would desync the movie from the frames it describes
+        chip8Config.rewindSeconds = 0;
+    }
 
-    Chip8 emulator;
-    emulator.loadProgram(romBuffer);
+    Chip8 emulator(seed.value_or(std::random_device{}()));
+    emulator.setQuirks(quirks.value_or(Chip8::MODERN_QUIRKS));
+    if (emulator.loadProgram(romImage) != Chip8::Status::OK) {
+        std::cerr << "ROM does not fit in memory:" << romPath << "\n";
+        return 1;
+    }
+    emulator.precompile();
 
-    Chip8SDLPlatform::Config chip8Config = {
-        .displayScale = 10,
-        .instructionsPerFrame = instructionsPerUpdate,
-    };
-    Chip8SDLPlatform platform(chip8Config);
-    platform.run(emulator);
+    std::unique_ptr<Chip8CaptureWriter> capture;
+    if (capturePath) {
+        capture = Chip8CaptureWriter::open(*capturePath);
+        if (!capture) {
+            std::cerr << "Failed to create capture:" << *capturePath << "\n";
+            return 1;
+        }
+        chip8Config.capture = capture.get();
+    }
+
+    {
+        Chip8SDLPlatform platform(chip8Config);
+        platform.run(emulator);
+    }
+    if (capture && !capture->close()) {
+        std::cerr << "Failed to write capture:" << *capturePath << "\n";
+        return 1;
+    }
+    if (capture && capture->droppedFrames()) {
+        std::cerr << "Capture dropped " << capture->droppedFrames()
+                  << " frames\n";
+    }
+
+    if (recordPath) {
+        auto data = movie.serialize();
+        std::ofstream out(*recordPath, std::ios::out | std::ios::binary);
+        out.write(reinterpret_cast<const char *>(data.data()), data.size());
+        if (out.fail()) {
+            std::cerr << "Failed to write movie:" << *recordPath << "\n";
+            return 1;
+        }
+    }
     return 0;
 }
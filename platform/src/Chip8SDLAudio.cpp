@@ -2,8 +2,21 @@
 #include "SDL3/SDL_init.h"
 #include <SDL3/SDL_audio.h>
 #include <SDL3/SDL_log.h>
-#include <cmath>
-#include <vector>
+#include <algorithm>
+
+namespace {
+constexpr int WAVE_TABLE_BITS = 8;
+constexpr int WAVE_TABLE_SIZE = 1 << WAVE_TABLE_BITS;
+
+// one period of the square wave; the top bits of the phase index it
+constexpr auto SQUARE_WAVE_TABLE = [] {
+    std::array<float, WAVE_TABLE_SIZE> table = {};
+    for (int i = 0; i < WAVE_TABLE_SIZE; i++) {
+        table[i] = i < WAVE_TABLE_SIZE / 2 ? 1.0f : -1.0f;
+    }
+    return table;
+}();
+} // namespace
 
 Chip8Audio::Chip8Audio() {
     SDL_InitSubSystem(SDL_INIT_AUDIO);
@@ -13,71 +26,126 @@ Chip8Audio::Chip8Audio() {
     spec.channels = 1;
 
     stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec,
-                                       nullptr, nullptr);
+                                       &Chip8Audio::feed, this);
 
     if (!stream) {
         SDL_Log("Failed to open audio: %s", SDL_GetError());
         return;
     }
 
-    SDL_PauseAudioStreamDevice(stream);
+    // silence costs a memset per callback, so the device just keeps running
+    SDL_ResumeAudioStreamDevice(stream);
 }
 
 Chip8Audio::~Chip8Audio() {
     if (stream) {
+        // stops the callback before the members it uses go away
         SDL_DestroyAudioStream(stream);
         stream = nullptr;
     }
     SDL_QuitSubSystem(SDL_INIT_AUDIO);
 }
 
-void Chip8Audio::generateSquareWave(float *buffer, int samples) {
-    const float phaseIncrement = (2.0f * M_PI * FREQUENCY) / SAMPLE_RATE;
-
+void Chip8Audio::generateSquareWave(float *buffer, int samples,
+                                    uint32_t &phase) {
+    // 32-bit phase accumulator, so a period is exactly 2^32
+    constexpr uint32_t phaseIncrement =
+        (static_cast<uint64_t>(FREQUENCY) << 32) / SAMPLE_RATE;
     for (int i = 0; i < samples; i++) {
-        buffer[i] = (std::sin(phase) >= 0.0f ? AMPLITUDE : -AMPLITUDE);
+        buffer[i] =
+            AMPLITUDE * SQUARE_WAVE_TABLE[phase >> (32 - WAVE_TABLE_BITS)];
         phase += phaseIncrement;
-
-        if (phase >= 2.0f * M_PI) {
-            phase -= 2.0f * M_PI;
-        }
     }
 }
 
-void Chip8Audio::play() {
-    if (!stream || playing) {
-        return;
+void Chip8Audio::generatePattern(float *buffer, int samples, uint32_t &phase,
+                                 const std::array<uint64_t, 2> &pattern,
+                                 uint32_t phaseIncrement) {
+    for (int i = 0; i < samples; i++) {
+        // the top seven bits of the phase pick one of the 128
+        const int bit = phase >> 25;
+        const bool high = pattern[bit >> 6] >> (63 - (bit & 63)) & 1;
+        buffer[i] = high ? AMPLITUDE : -AMPLITUDE;
+        phase += phaseIncrement;
     }
+}
 
-    std::vector<float> buffer(BUFFER_SIZE);
-    generateSquareWave(buffer.data(), BUFFER_SIZE);
-
-    SDL_PutAudioStreamData(stream, buffer.data(), BUFFER_SIZE * sizeof(float));
-    SDL_ResumeAudioStreamDevice(stream);
-    playing = true;
+void Chip8Audio::setPattern(std::span<const uint8_t, 16> pattern,
+                            double rate) {
+    for (int word = 0; word < 2; word++) {
+        uint64_t packed = 0;
+        for (int byte = 0; byte < 8; byte++) {
+            packed = packed << 8 | pattern[word * 8 + byte];
+        }
+        patternWords[word].store(packed, std::memory_order_relaxed);
+    }
+    // 2^32 is 128 bits, so one bit is 2^25 of phase
+    patternIncrement.store(
+        static_cast<uint32_t>(rate * (1u << 25) / SAMPLE_RATE),
+        std::memory_order_relaxed);
 }
 
-void Chip8Audio::stop() {
-    if (!stream || !playing) {
-        return;
+void Chip8Audio::push(uint64_t sample, bool on) {
+    if (!edges.push({sample, on})) {
+        SDL_Log("Audio edge queue full, dropping an edge");
     }
+}
 
-    SDL_PauseAudioStreamDevice(stream);
-    SDL_ClearAudioStream(stream);
-    phase = 0.0f;
-    playing = false;
+void SDLCALL Chip8Audio::feed(void *userdata, SDL_AudioStream *,
+                              int additionalAmount, int) {
+    static_cast<Chip8Audio *>(userdata)->render(additionalAmount /
+                                                sizeof(float));
 }
 
-void Chip8Audio::update() {
-    if (!stream || !playing) {
-        return;
+void Chip8Audio::syncTo(const Edge &edge) {
+    const uint64_t due = edge.sample + LATENCY_SAMPLES;
+    if (!synced || due + MAX_DRIFT_SAMPLES < clock ||
+        due > clock + MAX_DRIFT_SAMPLES) {
+        // first edge, or a stall, fast-forward or rewind moved emulated
+        // time away from the audio clock
+        clock = due;
+        synced = true;
     }
+}
 
-    int queued = SDL_GetAudioStreamQueued(stream);
-    if (queued < MIN_QUEUED_BYTES) {
-        std::vector<float> buffer(BUFFER_SIZE);
-        generateSquareWave(buffer.data(), BUFFER_SIZE);
-        SDL_PutAudioStreamData(stream, buffer.data(),
-                               BUFFER_SIZE * sizeof(float));
+void Chip8Audio::render(int samples) {
+    while (samples > 0) {
+        const int count = std::min(samples, CHUNK_SAMPLES);
+        const uint32_t increment =
+            patternIncrement.load(std::memory_order_relaxed);
+        const std::array<uint64_t, 2> pattern = {
+            patternWords[0].load(std::memory_order_relaxed),
+            patternWords[1].load(std::memory_order_relaxed),
+        };
+        int done = 0;
+        while (done < count) {
+            if (!hasPending && edges.pop(pending)) {
+                hasPending = true;
+                syncTo(pending);
+            }
+            int run = count - done;
+            if (hasPending) {
+                const uint64_t due = pending.sample + LATENCY_SAMPLES;
+                if (due <= clock) {
+                    gate = pending.on;
+                    hasPending = false;
+                    continue;
+                }
+                run = std::min<uint64_t>(run, due - clock);
+            }
+            if (gate && increment) {
+                generatePattern(&chunk[done], run, phase, pattern, increment);
+            } else if (gate) {
+                generateSquareWave(&chunk[done], run, phase);
+            } else {
+                // each beep starts on the same edge of the wave
+                std::fill_n(&chunk[done], run, 0.0f);
+                phase = 0;
+            }
+            done += run;
+            clock += run;
+        }
+        SDL_PutAudioStreamData(stream, chunk.data(), count * sizeof(float));
+        samples -= count;
     }
 }
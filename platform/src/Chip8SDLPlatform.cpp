@@ -5,14 +5,20 @@
 #include "SDL3/SDL_surface.h"
 #include "SDL3/SDL_timer.h"
 #include "SDL3/SDL_video.h"
+#include <Chip8PixelExpand.hpp>
 #include <Chip8SDLPlatform.hpp>
+#include <FramePacer.hpp>
+#include <algorithm>
+#include <bit>
 #include <cassert>
-#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <optional>
 #include <span>
 #include <stdexcept>
 #include <sys/types.h>
+#include <thread>
 #include <vector>
 
 #include "chip8.hpp"
@@ -33,7 +39,10 @@ Chip8SDLPlatform::~Chip8SDLPlatform() {
     }
 }
 
-Chip8SDLPlatform::Chip8SDLPlatform(const Config &config) : config(config) {
+Chip8SDLPlatform::Chip8SDLPlatform(const Config &config)
+    : config(config), speedMode(config.speedMode),
+      playback(config.replay ? std::span(config.replay->inputs)
+                             : std::span<const Chip8InputEvent>()) {
     // TODO use some kind of singleton manager?
     if (SDL_WasInit(SDL_INIT_VIDEO)) {
         throw std::runtime_error("SDL already initialized");
@@ -41,39 +50,85 @@ Chip8SDLPlatform::Chip8SDLPlatform(const Config &config) : config(config) {
 
     SDL_InitSubSystem(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 
+    if (config.rewindSeconds > 0) {
+        rewind.emplace(config.rewindSeconds * Chip8::TARGET_FPS,
+                       config.rewindBytes);
+    }
+
     window = SDL_CreateWindow(
-        "CHIP-8 Emulator", Chip8::getDisplayWidth() * config.displayScale,
-        Chip8::getDisplayHeight() * config.displayScale, SDL_WINDOW_RESIZABLE);
+        "CHIP-8 Emulator", Chip8::CHIP8_DISPLAY_WIDTH * config.displayScale,
+        Chip8::CHIP8_DISPLAY_HEIGHT * config.displayScale,
+        SDL_WINDOW_RESIZABLE);
 
     renderer = SDL_CreateRenderer(window, nullptr);
 
+    resizeTexture(Chip8::CHIP8_DISPLAY_WIDTH, Chip8::CHIP8_DISPLAY_HEIGHT);
+}
+
+void Chip8SDLPlatform::resizeTexture(int width, int height) {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
     // Maybe not streaming?
     texture =
         SDL_CreateTexture(renderer, SDL_PixelFormat::SDL_PIXELFORMAT_RGBA8888,
                           SDL_TextureAccess::SDL_TEXTUREACCESS_STREAMING,
-                          Chip8::getDisplayWidth(), Chip8::getDisplayHeight());
+                          width, height);
 
+    // the window keeps its size, so hi-res just gets finer pixels
     SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
 
-    pixelBuffer.resize(Chip8::getDisplayWidth() * Chip8::getDisplayHeight());
+    pixelBuffer.resize(width * height);
+    textureWidth = width;
+    textureHeight = height;
+    forceRedraw = true;
 }
 
-DisplayStatus
-Chip8SDLPlatform::render(std::span<const uint8_t> chip8DisplayBuf) {
+DisplayStatus Chip8SDLPlatform::render(std::span<const uint8_t> chip8DisplayBuf,
+                                       int width, int height,
+                                       uint32_t dirtyRows,
+                                       std::span<const uint8_t> secondPlane) {
     // displayBuf is an array of bytes where each pixel is a bit.
     // SDL Texture needs an array of uint32_t where each pixel is 0xFFFFFFFF
     // or 0x00000000
-    // assert((size * BITS_PER_BYTE >= DisplayPixelWidth * DisplayPixelHeight));
+    if (width != textureWidth || height != textureHeight) {
+        resizeTexture(width, height);
+    }
+    if (forceRedraw) {
+        dirtyRows = ~0u;
+        forceRedraw = false;
+    }
+    if (!dirtyRows) {
+        // the last presented frame is still on screen
+        return DisplayStatus::DISPLAY_OK;
+    }
 
-    for (std::size_t i = 0; i < pixelBuffer.size(); i++) {
-        int byteIdx = i / BITS_PER_BYTE;
-        int bitIdx = 7 - (i % BITS_PER_BYTE);
-        bool bitOn = (chip8DisplayBuf[byteIdx] >> bitIdx) & 1;
-        pixelBuffer.at(i) = bitOn ? 0xFFFFFFFF : 0x00000000;
+    const int rowBytes = width / BITS_PER_BYTE;
+    // in hi-res each dirty bit stands for two rows
+    const int rowsPerBit = height / Chip8::CHIP8_DISPLAY_HEIGHT;
+    while (dirtyRows) {
+        // expand and upload each run of consecutive dirty rows at once
+        const int firstBit = std::countr_zero(dirtyRows);
+        const int bitCount = std::countr_one(dirtyRows >> firstBit);
+        const int first = firstBit * rowsPerBit;
+        const int count = bitCount * rowsPerBit;
+        const auto rowsBytes =
+            chip8DisplayBuf.subspan(first * rowBytes, count * rowBytes);
+        if (secondPlane.empty()) {
+            expandDisplayBytes(rowsBytes, &pixelBuffer[first * width]);
+        } else {
+            expandDisplayPlanes(
+                rowsBytes,
+                secondPlane.subspan(first * rowBytes, count * rowBytes),
+                &pixelBuffer[first * width]);
+        }
+        const SDL_Rect rows = {0, first, width, count};
+        SDL_UpdateTexture(texture, &rows, &pixelBuffer[first * width],
+                          width * sizeof(uint32_t));
+        dirtyRows &=
+            ~static_cast<uint32_t>(((1ull << bitCount) - 1) << firstBit);
     }
 
-    SDL_UpdateTexture(texture, nullptr, pixelBuffer.data(),
-                      Chip8::getDisplayWidth() * sizeof(uint32_t));
     SDL_RenderClear(renderer);
     SDL_RenderTexture(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
@@ -81,40 +136,250 @@ Chip8SDLPlatform::render(std::span<const uint8_t> chip8DisplayBuf) {
 }
 
 void Chip8SDLPlatform::run(Chip8 &emulator) {
+    if (config.threaded) {
+        runThreaded(emulator);
+    } else {
+        runSerial(emulator);
+    }
+}
+
+void Chip8SDLPlatform::runSerial(Chip8 &emulator) {
     bool quit = false;
+    FramePacer pacer(Chip8::TARGET_FPS, MAX_CATCH_UP_FRAMES);
+    int framesDue = 1;
 
     while (!quit) {
-        auto frameStart = std::chrono::steady_clock::now();
-
         handleEvents(emulator, quit);
 
-        for (int i = 0; i < config.instructionsPerFrame; i++) {
-            auto status = emulator.step();
-            if (status != Chip8::Status::OK) {
-                // TODO update error handling
-                SDL_Log("Emulator error: %d", static_cast<int>(status));
+        runFrames(emulator, pacer, framesDue);
+
+        render(emulator.getDisplayBuffer(), emulator.getDisplayWidth(),
+               emulator.getDisplayHeight(), emulator.takeDirtyRows(),
+               emulator.getQuirks().xoChip ? emulator.getDisplayBuffer(1)
+                                           : std::span<const uint8_t>());
+
+        framesDue = pacer.wait();
+    }
+    logStats(pacer.getStats());
+}
+
+void Chip8SDLPlatform::runThreaded(Chip8 &emulator) {
+    bool quit = false;
+    // the emulator belongs to this thread until it is joined
+    std::jthread emulation(
+        [&](std::stop_token stop) { emulate(emulator, stop); });
+
+    Frame shown = {};
+    uint32_t seen = 0;
+    while (!quit) {
+        pollEvents(
+            [&](uint8_t chip8code, bool down) {
+                if (!keyEvents.push({chip8code, down})) {
+                    SDL_Log("Key event queue full, dropping key %d", chip8code);
+                }
+            },
+            quit);
+
+        // sleep until the core publishes, which it does every frame, so
+        // events are still polled at 60 Hz
+        framesPublished.wait(seen, std::memory_order_acquire);
+        seen = framesPublished.load(std::memory_order_acquire);
+        if (!frames.update()) {
+            continue;
+        }
+        // frames can be skipped, so diff against what is on screen rather
+        // than trusting a single frame's dirty rows
+        const Frame &frame = frames.front();
+        // one dirty bit per 1/32 of the display, as the core reports them
+        const int bitBytes = frame.width * frame.height / BITS_PER_BYTE /
+                             Chip8::CHIP8_DISPLAY_HEIGHT;
+        uint32_t dirtyRows = 0;
+        for (int bit = 0; bit < Chip8::CHIP8_DISPLAY_HEIGHT; bit++) {
+            if (memcmp(&frame.display[bit * bitBytes],
+                       &shown.display[bit * bitBytes], bitBytes) != 0 ||
+                (frame.hasSecondPlane &&
+                 memcmp(&frame.secondPlane[bit * bitBytes],
+                        &shown.secondPlane[bit * bitBytes], bitBytes) != 0)) {
+                dirtyRows |= 1u << bit;
             }
         }
+        // a mode switch redraws everything inside render()
+        shown = frame;
 
-        emulator.decrementTimers();
-        render(emulator.getDisplayBuffer());
-        if (emulator.shouldBeep()) {
-            audio.play();
-        } else {
-            audio.stop();
+        const int size = shown.width * shown.height / BITS_PER_BYTE;
+        render(std::span(shown.display).first(size), shown.width,
+               shown.height, dirtyRows,
+               shown.hasSecondPlane ? std::span(shown.secondPlane).first(size)
+                                    : std::span<const uint8_t>());
+    }
+}
+
+void Chip8SDLPlatform::emulate(Chip8 &emulator, std::stop_token stop) {
+    FramePacer pacer(Chip8::TARGET_FPS, MAX_CATCH_UP_FRAMES);
+    int framesDue = 1;
+
+    while (!stop.stop_requested()) {
+        // between frames is an instruction boundary
+        KeyEvent event;
+        while (keyEvents.pop(event)) {
+            if (event.down) {
+                emulator.handleKeyDown(event.chip8code);
+            } else {
+                emulator.handleKeyUp(event.chip8code);
+            }
+        }
+
+        runFrames(emulator, pacer, framesDue);
+
+        Frame &frame = frames.back();
+        auto display = emulator.getDisplayBuffer();
+        std::copy(display.begin(), display.end(), frame.display.begin());
+        frame.hasSecondPlane = emulator.getQuirks().xoChip;
+        if (frame.hasSecondPlane) {
+            auto second = emulator.getDisplayBuffer(1);
+            std::copy(second.begin(), second.end(), frame.secondPlane.begin());
         }
+        frame.width = emulator.getDisplayWidth();
+        frame.height = emulator.getDisplayHeight();
+        frames.publish();
+        framesPublished.fetch_add(1, std::memory_order_release);
+        framesPublished.notify_one();
 
-        auto frameEnd = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                           frameEnd - frameStart)
-                           .count();
+        framesDue = pacer.wait();
+    }
+    logStats(pacer.getStats());
+}
+
+void Chip8SDLPlatform::runFrames(Chip8 &emulator, const FramePacer &pacer,
+                                 int framesDue) {
+    if (rewinding.load(std::memory_order_relaxed)) {
+        // held on the oldest frame once the history runs out
+        if (rewind && rewind->stepBack(emulator)) {
+            frameNumber--;
+            // the restored state may have the beep on or off
+            pushSoundEvents(emulator, emulator.getCycles(), 0);
+            if (config.capture) {
+                config.capture->push(emulator.getDisplayBuffer(),
+                                     emulator.getDisplayWidth(),
+                                     emulator.getDisplayHeight());
+            }
+        }
+        return;
+    }
+    // after a stall the core catches up but only the last frame is drawn
+    switch (speedMode.load(std::memory_order_relaxed)) {
+    case SpeedMode::REAL_TIME:
+        for (int i = 0; i < framesDue; i++) {
+            runFrame(emulator);
+        }
+        break;
+    case SpeedMode::FAST_FORWARD:
+        for (int i = 0; i < framesDue * config.fastForwardFactor; i++) {
+            runFrame(emulator);
+        }
+        break;
+    case SpeedMode::UNCAPPED:
+        do {
+            runFrame(emulator);
+        } while (!pacer.isDue());
+        break;
+    }
+}
 
-        if (elapsed < Chip8::FRAME_TIME_MS) {
-            SDL_Delay(Chip8::FRAME_TIME_MS - elapsed);
+void Chip8SDLPlatform::runFrame(Chip8 &emulator) {
+    // keys only ever change between frames, so sampling here is exact
+    if (config.replay) {
+        playback.apply(emulator, frameNumber);
+        if (frameNumber == config.replay->frames) {
+            SDL_Log("Replay finished after %u frames", frameNumber);
         }
     }
+    if (config.recording) {
+        config.recording->record(frameNumber, emulator.getKeyState());
+        config.recording->frames = frameNumber + 1;
+    }
+    const uint64_t frameStart = emulator.getCycles();
+    const int budget = nextInstructionBudget();
+    auto status = emulator.runFrame(budget);
+    pushSoundEvents(emulator, frameStart, budget);
+    if (config.capture) {
+        config.capture->push(emulator.getDisplayBuffer(),
+                             emulator.getDisplayWidth(),
+                             emulator.getDisplayHeight());
+    }
+    frameNumber++;
+    // a SUPER-CHIP program that exited just keeps showing its last frame
+    if (status != Chip8::Status::OK &&
+        status != Chip8::Status::PROGRAM_EXITED) {
+        // TODO update error handling
+        SDL_Log("Emulator error: %d", static_cast<int>(status));
+    }
+    if (rewind) {
+        rewind->push(emulator);
+    }
+}
+
+void Chip8SDLPlatform::pushSoundEvents(Chip8 &emulator, uint64_t frameStart,
+                                       int budget) {
+    constexpr int samplesPerFrame =
+        Chip8Audio::SAMPLE_RATE / Chip8::TARGET_FPS;
+    const uint64_t frameSample =
+        static_cast<uint64_t>(frameNumber) * samplesPerFrame;
+    for (const auto &event : emulator.takeSoundEvents()) {
+        // the cycle's share of the frame's budget is its share of the
+        // frame's samples
+        const uint64_t offset =
+            std::min<uint64_t>(event.cycle - std::min(event.cycle, frameStart),
+                               budget);
+        audio.push(frameSample +
+                       (budget ? offset * samplesPerFrame / budget : 0),
+                   event.on);
+    }
+    if (emulator.getQuirks().xoChip) {
+        audio.setPattern(emulator.getAudioPattern(),
+                         emulator.getAudioPatternRate());
+    }
 }
+
+int Chip8SDLPlatform::nextInstructionBudget() {
+    if (config.cpuHz <= 0) {
+        return config.instructionsPerFrame;
+    }
+    // carry the fraction so e.g. 1000 Hz alternates 16 and 17 per frame
+    cycleCarry += config.cpuHz;
+    int budget = cycleCarry / Chip8::TARGET_FPS;
+    cycleCarry %= Chip8::TARGET_FPS;
+    return budget;
+}
+
+void Chip8SDLPlatform::logStats(const FramePacer::Stats &stats) const {
+    if (rewind) {
+        SDL_Log("Rewind: %d frames in %zu of %zu bytes",
+                rewind->getFramesStored(), rewind->getBytesUsed(),
+                rewind->getCapacityBytes());
+    }
+    SDL_Log("Frame pacing: %lld frames, jitter mean %.1f us max %.1f us, "
+            "%lld dropped",
+            static_cast<long long>(stats.waits),
+            stats.meanJitter().count() / 1000.0,
+            stats.maxJitter.count() / 1000.0,
+            static_cast<long long>(stats.dropped));
+}
+
 void Chip8SDLPlatform::handleEvents(Chip8 &emulator, bool &quit) {
+    pollEvents(
+        [&](uint8_t chip8code, bool down) {
+            if (down) {
+                emulator.handleKeyDown(chip8code);
+            } else {
+                emulator.handleKeyUp(chip8code);
+            }
+        },
+        quit);
+}
+
+template <typename KeySink>
+void Chip8SDLPlatform::pollEvents(KeySink &&onKey, bool &quit) {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
         switch (event.type) {
@@ -122,16 +387,35 @@ void Chip8SDLPlatform::handleEvents(Chip8 &emulator, bool &quit) {
             quit = true;
             break;
 
+        case SDL_EVENT_WINDOW_EXPOSED:
+        case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+            // the window contents are gone even if the display is not
+            forceRedraw = true;
+            break;
+
         case SDL_EVENT_KEY_DOWN: {
-            if (auto key = mapSDLToChip8(event.key.scancode)) {
-                emulator.handleKeyDown(key.value());
+            if (event.key.scancode == SDL_SCANCODE_BACKSPACE) {
+                // a movie's frames only run forward
+                if (config.rewindSeconds > 0 && !config.recording &&
+                    !config.replay) {
+                    rewinding.store(true, std::memory_order_relaxed);
+                }
+            } else if (auto mode = mapSDLToSpeedMode(event.key.scancode)) {
+                speedMode.store(mode.value(), std::memory_order_relaxed);
+                SDL_Log("Speed mode: %d", static_cast<int>(mode.value()));
+            } else if (auto key = mapSDLToChip8(event.key.scancode);
+                       key && !config.replay) {
+                onKey(key.value(), true);
             }
             break;
         }
 
         case SDL_EVENT_KEY_UP: {
-            if (auto key = mapSDLToChip8(event.key.scancode)) {
-                emulator.handleKeyUp(key.value());
+            if (event.key.scancode == SDL_SCANCODE_BACKSPACE) {
+                rewinding.store(false, std::memory_order_relaxed);
+            } else if (auto key = mapSDLToChip8(event.key.scancode);
+                       key && !config.replay) {
+                onKey(key.value(), false);
             }
             break;
         }
@@ -139,6 +423,20 @@ void Chip8SDLPlatform::handleEvents(Chip8 &emulator, bool &quit) {
     }
 }
 
+std::optional<SpeedMode>
+Chip8SDLPlatform::mapSDLToSpeedMode(SDL_Scancode code) {
+    switch (code) {
+    case SDL_SCANCODE_F1:
+        return SpeedMode::REAL_TIME;
+    case SDL_SCANCODE_F2:
+        return SpeedMode::FAST_FORWARD;
+    case SDL_SCANCODE_F3:
+        return SpeedMode::UNCAPPED;
+    default:
+        return std::nullopt;
+    }
+}
+
 std::expected<int, Chip8::Status>
 Chip8SDLPlatform::mapSDLToChip8(SDL_Scancode code) {
     // CHIP-8 keypad:     Keyboard:
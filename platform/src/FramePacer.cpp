@@ -0,0 +1,51 @@
+#include "FramePacer.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace {
+constexpr int64_t NANOS_PER_SECOND = 1'000'000'000;
+}
+
+FramePacer::FramePacer(int framesPerSecond, int maxCatchUpFrames)
+    : framesPerSecond(framesPerSecond), maxCatchUpFrames(maxCatchUpFrames),
+      period(NANOS_PER_SECOND / framesPerSecond),
+      periodRemainder(NANOS_PER_SECOND % framesPerSecond),
+      deadline(Clock::now() + period) {}
+
+void FramePacer::advance() {
+    deadline += period;
+    remainderCarry += periodRemainder;
+    if (remainderCarry >= framesPerSecond) {
+        remainderCarry -= framesPerSecond;
+        deadline += std::chrono::nanoseconds(1);
+    }
+}
+
+int FramePacer::wait() {
+    auto now = Clock::now();
+    if (deadline - now > SPIN_THRESHOLD) {
+        std::this_thread::sleep_until(deadline - SPIN_THRESHOLD);
+    }
+    while ((now = Clock::now()) < deadline) {
+        std::this_thread::yield();
+    }
+
+    auto jitter = now - deadline;
+    stats.waits++;
+    stats.totalJitter += jitter;
+    stats.maxJitter = std::max<std::chrono::nanoseconds>(stats.maxJitter, jitter);
+
+    int due = 1;
+    advance();
+    while (now >= deadline && due < maxCatchUpFrames) {
+        advance();
+        due++;
+    }
+    if (now >= deadline) {
+        // too far behind to catch up; drop the backlog and resync
+        stats.dropped += (now - deadline) / period + 1;
+        deadline = now + period;
+        remainderCarry = 0;
+    }
+    return due;
+}
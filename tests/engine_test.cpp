@@ -0,0 +1,333 @@
+#include "chip8.hpp"
+#include "chip8_disassembler.hpp"
+#include "common.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string &what) {
+    if (!condition) {
+        printf("FAIL: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+std::vector<uint8_t> assemble(const std::vector<uint16_t> &words) {
+    std::vector<uint8_t> rom;
+    for (auto word : words) {
+        rom.push_back(word >> BITS_PER_BYTE);
+        rom.push_back(word & 0xFF);
+    }
+    return rom;
+}
+
+std::unique_ptr<Chip8> load(const std::vector<uint8_t> &rom,
+                            const Chip8::Quirks &quirks) {
+    auto emulator = std::make_unique<Chip8>(1);
+    emulator->setQuirks(quirks);
+    emulator->loadProgram(rom);
+    return emulator;
+}
+
+std::vector<uint8_t> serialized(const Chip8 &emulator) {
+    std::vector<uint8_t> state(Chip8::SERIALIZED_STATE_SIZE);
+    emulator.serializeState(state);
+    return state;
+}
+
+// Runs `rom` for `frames` frames of `cycles` instructions, once a step()
+// at a time and once through runCycles(), and checks that both stop with
+// the same status, cycle count and state after every frame. The stepped
+// side drops its decode cache before every instruction, so it stands in
+// for a plain interpreter and a missed invalidation shows up as a diff.
+void checkMatchesStepping(const std::string &name,
+                          const std::vector<uint8_t> &rom, int frames,
+                          int cycles,
+                          const Chip8::Quirks &quirks = Chip8::MODERN_QUIRKS) {
+    auto stepped = load(rom, quirks);
+    auto blocks = load(rom, quirks);
+    for (int frame = 0; frame < frames; frame++) {
+        auto stepStatus = Chip8::Status::OK;
+        for (int i = 0; i < cycles && stepStatus == Chip8::Status::OK; i++) {
+            stepped->setQuirks(quirks);
+            stepStatus = stepped->step();
+        }
+        // runCycles() returns early after a display-wait draw, where
+        // step() carries on, so finish the frame's budget the same way
+        const uint64_t end = blocks->getCycles() + cycles;
+        auto blockStatus = Chip8::Status::OK;
+        while (blockStatus == Chip8::Status::OK && blocks->getCycles() < end) {
+            blockStatus = blocks->runCycles(
+                static_cast<int>(end - blocks->getCycles()));
+        }
+        const std::string where = name + " frame " + std::to_string(frame);
+        check(stepStatus == blockStatus, where + ": status");
+        check(stepped->getCycles() == blocks->getCycles(), where + ": cycles");
+        // byte for byte, which holds because serializeState() zeroes the
+        // padding; testSerializeIsDeterministic() covers that
+        check(serialized(*stepped) == serialized(*blocks), where + ": state");
+        if (stepStatus != Chip8::Status::OK ||
+            blockStatus != Chip8::Status::OK) {
+            return;
+        }
+        stepped->decrementTimers();
+        blocks->decrementTimers();
+    }
+}
+
+// FX55 rewrites the 73KK at 0x20C each trip, after the block holding it
+// has been compiled.
+void testStoreIntoCompiledBlock() {
+    checkMatchesStepping("FX55 into a compiled block",
+                         assemble({
+                             0x6073, // V0 = 0x73
+                             0x6100, // V1 = 0
+                             0x7105, // V1 += 5
+                             0xA20C, // I = 0x20C
+                             0xF155, // 0x20C = 73 V1
+                             0x6400, // V4 = 0
+                             0x6300, // becomes V3 += V1
+                             0x1204,
+                         }),
+                         20, 100);
+}
+
+// FX33 patches the KK of the skip at 0x20C with the hundreds digit of V3,
+// which V0 is then loaded with, so a stale decode falls into the data
+// word at 0x20E.
+void testBcdIntoCompiledBlock() {
+    checkMatchesStepping("FX33 into a compiled block",
+                         assemble({
+                             0x6300, // V3 = 0
+                             0xA20D, // I = 0x20D
+                             0xF333, // 0x20D-0x20F = BCD of V3
+                             0xA20D, // I = 0x20D
+                             0xF065, // V0 = hundreds
+                             0x7401, // V4 += 1
+                             0x3007, // skip if V0 == hundreds
+                             0x0000, // tens and ones, never run
+                             0x7301, // V3 += 1
+                             0x1202,
+                         }),
+                         40, 97);
+}
+
+// The FX07; 3XKK; 1NNN delay loop and the jump to itself both
+// fast-forward, including budgets that end mid-trip.
+void testIdleSkip() {
+    const auto rom = assemble({
+        0x6007, // V0 = 7
+        0xF015, // DT = V0
+        0xF107, // V1 = DT
+        0x3100, // skip if V1 == 0
+        0x1204,
+        0x7201, // V2 += 1
+        0x120A,
+    });
+    for (int cycles : {1, 2, 3, 4, 5, 100, 1000}) {
+        checkMatchesStepping("idle skip at " + std::to_string(cycles), rom,
+                             12, cycles);
+    }
+}
+
+// A breakpoint on the 3XKK or the 1NNN of a delay loop stops every trip
+// instead of being fast-forwarded past.
+void testBreakpointInIdleLoop() {
+    const auto rom = assemble({
+        0x6007, // V0 = 7
+        0xF015, // DT = V0
+        0xF107, // V1 = DT
+        0x3100, // skip if V1 == 0
+        0x1204,
+    });
+    for (uint16_t address : {0x206, 0x208}) {
+        auto emulator = load(rom, Chip8::MODERN_QUIRKS);
+        emulator->addBreakpoint(address);
+        const std::string where =
+            "breakpoint in idle loop at " + std::to_string(address);
+        for (int trip = 0; trip < 3; trip++) {
+            const uint64_t start = emulator->getCycles();
+            check(emulator->runCycles(1000) == Chip8::Status::BREAKPOINT,
+                  where + ": status");
+            check(emulator->getState().pc == address, where + ": PC");
+            // within one trip, not after a fast-forward
+            check(emulator->getCycles() - start <= 4, where + ": cycles");
+            emulator->resume();
+        }
+    }
+}
+
+// FX0A with no key down waits out the whole budget.
+void testKeyWaitSkip() {
+    checkMatchesStepping("key wait",
+                         assemble({0x6005, 0xF00A, 0x7001, 0x1202}), 4, 500);
+}
+
+// Fills a deeper stack frame with a pattern before serializing, so padding
+// copied from the stack would show up against a shallow call.
+[[gnu::noinline]] std::vector<uint8_t> serializedOverDirtyStack(
+    const Chip8 &emulator, int depth) {
+    volatile uint8_t dirt[4096];
+    for (auto &byte : dirt) {
+        byte = 0xA5 + depth;
+    }
+    if (depth > 0) {
+        return serializedOverDirtyStack(emulator, depth - 1);
+    }
+    return serialized(emulator);
+}
+
+// The same state serializes to the same bytes however deep the caller is.
+void testSerializeIsDeterministic() {
+    auto emulator = load(assemble({0x6007, 0xF015, 0xC0FF, 0x1204}),
+                         Chip8::MODERN_QUIRKS);
+    emulator->runCycles(10);
+    const auto shallow = serialized(*emulator);
+    for (int depth : {0, 1, 4}) {
+        check(serializedOverDirtyStack(*emulator, depth) == shallow,
+              "serialized state at depth " + std::to_string(depth));
+    }
+}
+
+// Every opcode, under the classic, SUPER-CHIP and XO-CHIP sets: the core
+// stops on exactly the ones isValidInstruction() rejects, and the
+// disassembler calls exactly those data.
+void testInstructionValidity() {
+    const std::pair<const char *, Chip8::Quirks> presets[] = {
+        {"modern", Chip8::MODERN_QUIRKS},
+        {"schip", Chip8::SCHIP_QUIRKS},
+        {"xochip", Chip8::XO_CHIP_QUIRKS},
+    };
+    for (const auto &[presetName, quirks] : presets) {
+        std::vector<uint8_t> rom(2);
+        auto emulator = load(rom, quirks);
+        for (int instruction = 0; instruction <= 0xFFFF; instruction++) {
+            rom[0] = instruction >> BITS_PER_BYTE;
+            rom[1] = instruction & 0xFF;
+            // reloads the image loadProgram() kept a view of
+            emulator->reset();
+            const bool valid = Chip8::isValidInstruction(instruction, quirks);
+            const bool ran =
+                emulator->step() != Chip8::Status::INVALID_INSTRUCTION;
+            const bool data =
+                Chip8Disassembler::disassemble(instruction, quirks)
+                    .starts_with("DW");
+            char where[48];
+            snprintf(where, sizeof(where), "validity of %04X under %s",
+                     instruction, presetName);
+            check(ran == valid, std::string(where) + ": core");
+            check(data == !valid, std::string(where) + ": disassembler");
+        }
+    }
+}
+
+// Random programs under every quirk preset, errors included.
+void testRandomPrograms() {
+    const std::pair<const char *, Chip8::Quirks> presets[] = {
+        {"modern", Chip8::MODERN_QUIRKS},
+        {"vip", Chip8::COSMAC_VIP_QUIRKS},
+        {"chip48", Chip8::CHIP48_QUIRKS},
+        {"schip", Chip8::SCHIP_QUIRKS},
+        {"xochip", Chip8::XO_CHIP_QUIRKS},
+    };
+    std::mt19937 rng(2);
+    for (const auto &[presetName, quirks] : presets) {
+        for (int program = 0; program < 200; program++) {
+            std::vector<uint8_t> rom(256);
+            for (auto &byte : rom) {
+                byte = static_cast<uint8_t>(rng());
+            }
+            checkMatchesStepping(std::string("random ") + presetName + " " +
+                                     std::to_string(program),
+                                 rom, 8, 64, quirks);
+        }
+    }
+}
+
+// A skip over F000 NNNN steps past all four bytes of it, in the block
+// compiler as in step().
+void testXoChipLongSkip() {
+    const auto rom = assemble({
+        0x6005, // V0 = 5
+        0x3005, // skip if V0 == 5
+        0xF000, // I = 0x6001, skipped whole
+        0x6001,
+        0x7101, // V1 += 1
+        0x1202,
+    });
+    checkMatchesStepping("XO-CHIP long skip", rom, 4, 50,
+                         Chip8::XO_CHIP_QUIRKS);
+    auto emulator = load(rom, Chip8::XO_CHIP_QUIRKS);
+    emulator->runCycles(2);
+    check(emulator->getState().pc == 0x208, "long skip: PC");
+    check(emulator->getState().i == 0, "long skip: I");
+}
+
+// 5XY2 and 5XY3 move a register range in either direction through memory
+// above the classic 4 KB, and leave I alone.
+void testXoChipRegisterRanges() {
+    auto emulator = load(assemble({
+                             0xF000, // I = 0x8000
+                             0x8000,
+                             0x6011, // V0 = 0x11
+                             0x6122, // V1 = 0x22
+                             0x6233, // V2 = 0x33
+                             0x5022, // 0x8000-0x8002 = V0-V2
+                             0x5203, // V2-V0 = 0x8000-0x8002
+                         }),
+                         Chip8::XO_CHIP_QUIRKS);
+    emulator->runCycles(6);
+    const auto state = emulator->getState();
+    check(state.i == 0x8000, "register ranges: I");
+    check(emulator->getMemory()[0x8001] == 0x22, "register ranges: store");
+    check(state.registers[0] == 0x33 && state.registers[1] == 0x22 &&
+              state.registers[2] == 0x11,
+          "register ranges: reversed load");
+}
+
+// FN01 picks the planes DXYN draws to, each taking the next sprite from I.
+void testXoChipPlanes() {
+    auto emulator = load(assemble({
+                             0xA20C, // I = sprite
+                             0xF201, // second plane only
+                             0xD001, // draw 1 row at 0, 0
+                             0xF301, // both planes
+                             0xD011, // draw 1 row each at 0, 0
+                             0x120A,
+                             0x80C0, // sprite bytes
+                         }),
+                         Chip8::XO_CHIP_QUIRKS);
+    emulator->runCycles(5);
+    check(emulator->getDisplayBuffer(0)[0] == 0x80, "planes: first plane");
+    check(emulator->getDisplayBuffer(1)[0] == 0x40, "planes: second plane");
+    check(emulator->getState().registers[0xF] == 1, "planes: collision");
+}
+
+} // namespace
+
+int main() {
+    testStoreIntoCompiledBlock();
+    testBcdIntoCompiledBlock();
+    testIdleSkip();
+    testBreakpointInIdleLoop();
+    testKeyWaitSkip();
+    testSerializeIsDeterministic();
+    testInstructionValidity();
+    testRandomPrograms();
+    testXoChipLongSkip();
+    testXoChipRegisterRanges();
+    testXoChipPlanes();
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
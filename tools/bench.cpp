@@ -0,0 +1,464 @@
+#include "Chip8PixelExpand.hpp"
+#include "chip8.hpp"
+#include "chip8_lockstep.hpp"
+#include "common.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef CHIP8_BENCH_AUDIO
+#include "Chip8SDLAudio.hpp"
+#endif
+
+// Microbenchmarks for the core. The command line and the JSON report follow
+// Google Benchmark's, so its compare.py and dashboards read the output as is.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// keeps the compiler from dropping a result nobody reads
+template <typename T> void doNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class State {
+  public:
+    explicit State(long iterations) : remaining(iterations) {}
+
+    // true `iterations` times; the clock runs from the first call to the last
+    bool keepRunning() {
+        if (!started) {
+            started = true;
+            cpuStart = std::clock();
+            realStart = Clock::now();
+        }
+        if (remaining-- > 0 && error.empty()) {
+            return true;
+        }
+        realSeconds =
+            std::chrono::duration<double>(Clock::now() - realStart).count();
+        cpuSeconds = static_cast<double>(std::clock() - cpuStart) /
+                     CLOCKS_PER_SEC;
+        return false;
+    }
+    // items handled by one iteration, for the items_per_second counter
+    void setItemsProcessed(long items) { itemsProcessed = items; }
+    void skipWithError(std::string message) { error = std::move(message); }
+
+    long itemsProcessed = 0;
+    double realSeconds = 0.0;
+    double cpuSeconds = 0.0;
+    std::string error;
+
+  private:
+    long remaining;
+    bool started = false;
+    std::clock_t cpuStart = 0;
+    Clock::time_point realStart;
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(State &)> run;
+};
+
+struct Result {
+    std::string name;
+    long iterations = 0;
+    double realNs = 0.0;
+    double cpuNs = 0.0;
+    double itemsPerSecond = 0.0;
+    std::string error;
+};
+
+// Instructions as big-endian words, loaded at PROGRAM_START.
+std::vector<uint8_t> assemble(const std::vector<uint16_t> &words) {
+    std::vector<uint8_t> rom;
+    for (auto word : words) {
+        rom.push_back(word >> BITS_PER_BYTE);
+        rom.push_back(word & 0xFF);
+    }
+    return rom;
+}
+
+// `prologue` once, then `body` repeated until the jump back to its start.
+std::vector<uint8_t> unrolledRom(const std::vector<uint16_t> &prologue,
+                                 uint16_t body, int copies = 256) {
+    std::vector<uint16_t> words = prologue;
+    uint16_t loop = Chip8::Chip8Hardware::PROGRAM_START + 2 * prologue.size();
+    words.insert(words.end(), copies, body);
+    words.push_back(0x1000 | loop);
+    return assemble(words);
+}
+
+constexpr int STEPS_PER_ITERATION = 1000;
+
+// Steps a ROM one instruction at a time, the way a debugger or the lockstep
+// fallback drives the core.
+void benchStep(State &state, const std::vector<uint8_t> &rom) {
+    Chip8 emulator(1);
+    emulator.loadProgram(rom);
+    while (state.keepRunning()) {
+        for (int i = 0; i < STEPS_PER_ITERATION; i++) {
+            if (emulator.step() != Chip8::Status::OK) {
+                state.skipWithError("step failed");
+                break;
+            }
+        }
+    }
+    state.setItemsProcessed(STEPS_PER_ITERATION);
+    doNotOptimize(emulator.getDisplayBuffer()[0]);
+}
+
+// Whole-ROM throughput through the block engine.
+void benchRun(State &state, const std::vector<uint8_t> &rom) {
+    Chip8 emulator(1);
+    emulator.loadProgram(rom);
+    while (state.keepRunning()) {
+        if (emulator.runCycles(STEPS_PER_ITERATION) != Chip8::Status::OK) {
+            state.skipWithError("runCycles failed");
+        }
+    }
+    state.setItemsProcessed(STEPS_PER_ITERATION);
+    doNotOptimize(emulator.getDisplayBuffer()[0]);
+}
+
+// Lanes machines through one ROM with the SIMD lockstep engine; an item is
+// one instruction on one lane.
+template <int Lanes>
+void benchLockstep(State &state, const std::vector<uint8_t> &rom) {
+    auto lockstep = std::make_unique<Chip8Lockstep<Lanes>>(1);
+    lockstep->loadProgram(rom);
+    while (state.keepRunning()) {
+        for (int i = 0; i < STEPS_PER_ITERATION; i++) {
+            if (lockstep->step() != Chip8::Status::OK) {
+                state.skipWithError("lockstep step failed");
+                break;
+            }
+        }
+    }
+    state.setItemsProcessed(static_cast<long>(STEPS_PER_ITERATION) * Lanes);
+    doNotOptimize(lockstep->getDisplayBuffer(0)[0]);
+}
+
+// The baseline for benchLockstep: as many separate machines, each
+// stepped in turn.
+template <int Lanes>
+void benchStepLoop(State &state, const std::vector<uint8_t> &rom) {
+    std::vector<std::unique_ptr<Chip8>> emulators;
+    for (int lane = 0; lane < Lanes; lane++) {
+        emulators.push_back(std::make_unique<Chip8>(1 + lane));
+        emulators.back()->loadProgram(rom);
+    }
+    while (state.keepRunning()) {
+        for (auto &emulator : emulators) {
+            for (int i = 0; i < STEPS_PER_ITERATION; i++) {
+                if (emulator->step() != Chip8::Status::OK) {
+                    state.skipWithError("step failed");
+                    break;
+                }
+            }
+        }
+    }
+    state.setItemsProcessed(static_cast<long>(STEPS_PER_ITERATION) * Lanes);
+    doNotOptimize(emulators[0]->getDisplayBuffer()[0]);
+}
+
+std::vector<Benchmark> registerBenchmarks() {
+    std::vector<Benchmark> benchmarks;
+    auto perStep = [](auto bench, std::vector<uint8_t> rom) {
+        return [bench, rom = std::move(rom)](State &state) {
+            bench(state, rom);
+        };
+    };
+
+    // I points below the display so memory writes stay out of the ROM
+    const std::vector<uint16_t> setup = {0x6005, 0x6107, 0x62FF, 0xAE00};
+    // sprite and index reads stay inside the font
+    const std::vector<uint16_t> fontSetup = {0x6000, 0x6100, 0xA000};
+    const std::pair<const char *, uint16_t> opcodes[] = {
+        {"3XKK_skip", 0x3001},      {"6XKK_load", 0x6342},
+        {"7XKK_add", 0x7301},       {"8XY4_add_carry", 0x8014},
+        {"8XY5_sub", 0x8015},       {"8XY6_shift", 0x8016},
+        {"ANNN_index", 0xAE00},     {"CXKK_random", 0xC3FF},
+        {"EX9E_key", 0xE09E},       {"FX33_bcd", 0xF233},
+        {"FX55_store", 0xF355},     {"FX65_load", 0xF365},
+    };
+    for (const auto &[name, word] : opcodes) {
+        benchmarks.push_back({std::string("BM_Step/") + name,
+                              perStep(benchStep, unrolledRom(setup, word))});
+    }
+    benchmarks.push_back({"BM_Step/DXYN_draw",
+                          perStep(benchStep, unrolledRom(fontSetup, 0xD015))});
+    benchmarks.push_back(
+        {"BM_Step/FX1E_add_index",
+         perStep(benchStep, unrolledRom(fontSetup, 0xF01E))});
+    benchmarks.push_back(
+        {"BM_Step/1NNN_jump", perStep(benchStep, assemble({0x1200}))});
+    benchmarks.push_back(
+        {"BM_Step/2NNN_00EE_call_return",
+         perStep(benchStep, assemble({0x2204, 0x1200, 0x00EE}))});
+
+    // DXYN on its own: heights by aligned, unaligned and wrapping positions
+    struct Position {
+        const char *name;
+        int x;
+        int y;
+    };
+    const Position positions[] = {
+        {"aligned", 8, 4}, {"unaligned", 3, 4}, {"wrap", 60, 30}};
+    for (int height : {1, 5, 15}) {
+        for (const auto &position : positions) {
+            benchmarks.push_back(
+                {"BM_DrawSprite/" + std::to_string(height) + "/" +
+                     position.name,
+                 [height, position](State &state) {
+                     std::array<uint8_t, Chip8::Chip8Hardware::DISPLAY_SIZE>
+                         display = {};
+                     std::array<uint8_t, 15> sprite;
+                     sprite.fill(0xA5);
+                     while (state.keepRunning()) {
+                         doNotOptimize(Chip8::drawSprite(
+                             display, std::span(sprite).first(height),
+                             position.x, position.y));
+                     }
+                     state.setItemsProcessed(height);
+                 }});
+        }
+    }
+
+    benchmarks.push_back({"BM_ExpandDisplay", [](State &state) {
+                              std::array<uint8_t,
+                                         Chip8::Chip8Hardware::DISPLAY_SIZE>
+                                  display;
+                              for (std::size_t i = 0; i < display.size(); i++) {
+                                  display[i] = i * 37;
+                              }
+                              std::vector<uint32_t> pixels(display.size() *
+                                                           BITS_PER_BYTE);
+                              while (state.keepRunning()) {
+                                  expandDisplayBytes(display, pixels.data());
+                                  doNotOptimize(pixels[0]);
+                              }
+                              state.setItemsProcessed(pixels.size());
+                          }});
+
+#ifdef CHIP8_BENCH_AUDIO
+    benchmarks.push_back({"BM_SquareWave/4096", [](State &state) {
+                              std::vector<float> buffer(4096);
+                              uint32_t phase = 0;
+                              while (state.keepRunning()) {
+                                  Chip8Audio::generateSquareWave(
+                                      buffer.data(), buffer.size(), phase);
+                                  doNotOptimize(buffer[0]);
+                              }
+                              state.setItemsProcessed(buffer.size());
+                          }});
+#endif
+
+    // synthetic whole programs
+    const auto aluLoop = assemble({0x8014, 0x8125, 0x8206, 0x830E, 0x7401,
+                                   0x8543, 0x8652, 0x3700, 0x8761, 0x1200});
+    benchmarks.push_back({"BM_Run/alu_loop", perStep(benchRun, aluLoop)});
+    benchmarks.push_back(
+        {"BM_Run/sprite_storm",
+         perStep(benchRun, assemble({0xA000, 0xD01F, 0x7003, 0x7105, 0xD23A,
+                                     0x7207, 0x1202}))});
+    benchmarks.push_back(
+        {"BM_Run/call_return",
+         perStep(benchRun, assemble({0x2206, 0x7001, 0x1200, 0x220A, 0x00EE,
+                                     0x00EE}))});
+
+    // the lockstep engine against stepping the same machines one by one
+    benchmarks.push_back(
+        {"BM_Lockstep/8", perStep(benchLockstep<8>, aluLoop)});
+    benchmarks.push_back(
+        {"BM_Lockstep/16", perStep(benchLockstep<16>, aluLoop)});
+    benchmarks.push_back(
+        {"BM_Lockstep/32", perStep(benchLockstep<32>, aluLoop)});
+    benchmarks.push_back(
+        {"BM_StepLoop/8", perStep(benchStepLoop<8>, aluLoop)});
+    benchmarks.push_back(
+        {"BM_StepLoop/16", perStep(benchStepLoop<16>, aluLoop)});
+    benchmarks.push_back(
+        {"BM_StepLoop/32", perStep(benchStepLoop<32>, aluLoop)});
+    return benchmarks;
+}
+
+// Doubles the iteration count until a run takes at least `minTime`.
+Result measure(const Benchmark &benchmark, double minTime) {
+    Result result{.name = benchmark.name,
+                  .iterations = 0,
+                  .realNs = 0.0,
+                  .cpuNs = 0.0,
+                  .itemsPerSecond = 0.0,
+                  .error = {}};
+    for (long iterations = 1;; iterations *= 2) {
+        State state(iterations);
+        benchmark.run(state);
+        if (!state.error.empty() || state.realSeconds >= minTime ||
+            iterations >= 1L << 40) {
+            result.iterations = iterations;
+            result.realNs = state.realSeconds * 1e9 / iterations;
+            result.cpuNs = state.cpuSeconds * 1e9 / iterations;
+            if (state.itemsProcessed > 0 && state.realSeconds > 0) {
+                result.itemsPerSecond =
+                    state.itemsProcessed * iterations / state.realSeconds;
+            }
+            result.error = state.error;
+            return result;
+        }
+    }
+}
+
+std::string toJson(const std::vector<Result> &results, const char *program) {
+    char date[64];
+    auto now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z",
+                  std::localtime(&now));
+    std::ostringstream out;
+    out << "{\n  \"context\": {\n"
+        << "    \"date\": \"" << date << "\",\n"
+        << "    \"executable\": \"" << program << "\",\n"
+        << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+        << "    \"library_build_type\": \"release\"\n"
+#else
+        << "    \"library_build_type\": \"debug\"\n"
+#endif
+        << "  },\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const auto &result = results[i];
+        out << (i ? ",\n" : "\n") << "    {\n"
+            << "      \"name\": \"" << result.name << "\",\n"
+            << "      \"run_name\": \"" << result.name << "\",\n"
+            << "      \"run_type\": \"iteration\",\n"
+            << "      \"iterations\": " << result.iterations << ",\n"
+            << "      \"real_time\": " << result.realNs << ",\n"
+            << "      \"cpu_time\": " << result.cpuNs << ",\n"
+            << "      \"time_unit\": \"ns\"";
+        if (!result.error.empty()) {
+            out << ",\n      \"error_occurred\": true,\n"
+                << "      \"error_message\": \"" << result.error << "\"";
+        } else if (result.itemsPerSecond > 0) {
+            out << ",\n      \"items_per_second\": " << result.itemsPerSecond;
+        }
+        out << "\n    }";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+void printConsoleRow(const Result &result) {
+    if (!result.error.empty()) {
+        printf("%-40s ERROR: %s\n", result.name.c_str(), result.error.c_str());
+        return;
+    }
+    printf("%-40s %12.1f ns %12.1f ns %12ld", result.name.c_str(),
+           result.realNs, result.cpuNs, result.iterations);
+    if (result.itemsPerSecond > 0) {
+        printf(" %10.3fM items/s", result.itemsPerSecond / 1e6);
+    }
+    printf("\n");
+}
+
+void printUsage(const char *program) {
+    printf("Usage: %s [options]\n"
+           "  --benchmark_filter=<regex>        run matching benchmarks only\n"
+           "  --benchmark_min_time=<seconds>    time per benchmark (default "
+           "0.5)\n"
+           "  --benchmark_format=console|json   stdout format\n"
+           "  --benchmark_out=<file>            also write JSON to a file\n"
+           "  --benchmark_list_tests            list names and exit\n",
+           program);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string filter = ".";
+    double minTime = 0.5;
+    bool json = false;
+    bool listOnly = false;
+    std::string outPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = arg.substr(arg.find('=') + 1);
+        if (arg.starts_with("--benchmark_filter=")) {
+            filter = value;
+        } else if (arg.starts_with("--benchmark_min_time=")) {
+            // Google's "0.5s" spelling is accepted too
+            minTime = std::stod(value);
+        } else if (arg == "--benchmark_format=json") {
+            json = true;
+        } else if (arg == "--benchmark_format=console") {
+            json = false;
+        } else if (arg.starts_with("--benchmark_out=")) {
+            outPath = value;
+        } else if (arg == "--benchmark_list_tests" ||
+                   arg == "--benchmark_list_tests=true") {
+            listOnly = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::regex pattern;
+    try {
+        pattern = std::regex(filter);
+    } catch (const std::regex_error &) {
+        std::cerr << "Invalid filter:" << filter << "\n";
+        return 1;
+    }
+
+    std::vector<Result> results;
+    if (!json && !listOnly) {
+        printf("%-40s %15s %15s %12s\n", "Benchmark", "Time", "CPU",
+               "Iterations");
+    }
+    for (const auto &benchmark : registerBenchmarks()) {
+        if (!std::regex_search(benchmark.name, pattern)) {
+            continue;
+        }
+        if (listOnly) {
+            printf("%s\n", benchmark.name.c_str());
+            continue;
+        }
+        results.push_back(measure(benchmark, minTime));
+        if (!json) {
+            printConsoleRow(results.back());
+        }
+    }
+    if (listOnly) {
+        return 0;
+    }
+
+    auto report = toJson(results, argv[0]);
+    if (json) {
+        printf("%s", report.c_str());
+    }
+    if (!outPath.empty()) {
+        std::ofstream out(outPath);
+        out << report;
+        if (out.fail()) {
+            std::cerr << "Failed to write file:" << outPath << "\n";
+            return 1;
+        }
+    }
+    bool failed = std::any_of(results.begin(), results.end(),
+                              [](const Result &r) { return !r.error.empty(); });
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,94 @@
+#include "chip8_capture.hpp"
+#include "chip8_rom_cache.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+
+namespace {
+
+void printUsage(const char *program) {
+    printf("Usage: %s <capture> [options]\n"
+           "  --y4m <file>   export raw YUV4MPEG2 video\n"
+           "  --apng <file>  export an animated PNG\n"
+           "  --scale <n>    pixels per CHIP-8 pixel (default 4)\n",
+           program);
+}
+
+bool exportTo(const std::filesystem::path &path,
+              std::span<const uint8_t> capture, int scale,
+              bool (*exporter)(std::span<const uint8_t>, std::ostream &,
+                               int)) {
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    if (out.fail() || !exporter(capture, out, scale)) {
+        std::cerr << "Failed to export:" << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::filesystem::path capturePath;
+    std::optional<std::filesystem::path> y4mPath;
+    std::optional<std::filesystem::path> apngPath;
+    int scale = 4;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--y4m") {
+            y4mPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--apng") {
+            apngPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--scale") {
+            scale = std::stoi(argv[++i]);
+        } else if (!arg.starts_with("--") && capturePath.empty()) {
+            capturePath = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (capturePath.empty() || scale <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // not a ROM, but mapped all the same
+    auto mapped = Chip8RomCache::open(capturePath);
+    auto decoder = mapped && mapped->roms().size() == 1
+                       ? Chip8CaptureDecoder::open(mapped->roms()[0].image)
+                       : std::nullopt;
+    if (!decoder) {
+        std::cerr << "Not a capture:" << capturePath << "\n";
+        return 1;
+    }
+    const auto capture = mapped->roms()[0].image;
+
+    long frames = 0;
+    long hiresFrames = 0;
+    while (auto frame = decoder->next()) {
+        frames++;
+        hiresFrames += frame->width == Chip8::SCHIP_DISPLAY_WIDTH;
+    }
+    printf("Frames: %ld (%.1f s), %ld hi-res\n", frames,
+           static_cast<double>(frames) / Chip8::TARGET_FPS, hiresFrames);
+    printf("Size: %zu bytes, %.2f per frame\n", capture.size(),
+           frames ? static_cast<double>(capture.size()) / frames : 0.0);
+    if (decoder->corrupt()) {
+        std::cerr << "Capture is corrupt after frame " << frames << "\n";
+        return 1;
+    }
+
+    if (y4mPath &&
+        !exportTo(*y4mPath, capture, scale, &Chip8CaptureExport::toY4m)) {
+        return 1;
+    }
+    if (apngPath &&
+        !exportTo(*apngPath, capture, scale, &Chip8CaptureExport::toApng)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "chip8.hpp"
+#include "chip8_disassembler.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void printUsage(const char *program) {
+    printf("Usage: %s <program_path> [options]\n"
+           "  --dot             print the control-flow graph in Graphviz form\n"
+           "  --quiet           print only the summary\n"
+           "  --quirks <name>   modern (default), vip, chip48, schip\n"
+           "                    or xochip\n",
+           program);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::filesystem::path romPath;
+    bool dot = false;
+    bool quiet = false;
+    Chip8::Quirks quirks = Chip8::MODERN_QUIRKS;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--dot") {
+            dot = true;
+        } else if (arg == "--quiet") {
+            quiet = true;
+        } else if (i + 1 < argc && arg == "--quirks") {
+            auto preset = Chip8::findQuirks(argv[++i]);
+            if (!preset) {
+                std::cerr << "Unknown quirks:" << argv[i] << "\n";
+                return 1;
+            }
+            quirks = *preset;
+        } else if (!arg.starts_with("--") && romPath.empty()) {
+            romPath = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (romPath.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream rom(romPath, std::ios::in | std::ios::binary);
+    if (rom.fail()) {
+        std::cerr << "Failed to open file:" << romPath << "\n";
+        return 1;
+    }
+    std::vector<uint8_t> romBuffer((std::istreambuf_iterator<char>(rom)),
+                                   std::istreambuf_iterator<char>());
+    // analyse the memory image the interpreter would run, font included
+    Chip8 emulator(0);
+    emulator.setQuirks(quirks);
+    if (emulator.loadProgram(romBuffer) != Chip8::Status::OK) {
+        std::cerr << "ROM does not fit in memory:" << romPath << "\n";
+        return 1;
+    }
+
+    const auto memory = emulator.getMemory();
+    const auto cfg = Chip8Disassembler::buildCfg(
+        memory, Chip8::Chip8Hardware::PROGRAM_START, quirks);
+    if (dot) {
+        printf("%s", Chip8Disassembler::toDot(cfg).c_str());
+        return 0;
+    }
+    if (!quiet) {
+        printf("%s\n", Chip8Disassembler::listing(memory, cfg).c_str());
+    }
+    printf("Blocks: %zu, subroutines: %zu\n", cfg.blocks.size(),
+           cfg.subroutines.size());
+    printf("Computed jumps: %zu, invalid instructions: %zu\n",
+           cfg.computedJumps.size(), cfg.invalidInstructions.size());
+    printf("Stores into code: %zu, through unknown I: %zu\n",
+           cfg.selfModifying.size(), cfg.unresolvedStores.size());
+    return 0;
+}
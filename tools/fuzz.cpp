@@ -0,0 +1,354 @@
+#include "chip8.hpp"
+#include "chip8_arena.hpp"
+#include "chip8_movie.hpp"
+#include "chip8_rom_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+void printUsage(const char *program) {
+    printf("Usage: %s <program_path> [options]\n"
+           "  --frames <n>       frames per run (default 120)\n"
+           "  --ipf <n>          instructions per frame (default 500)\n"
+           "  --quirks <name>    modern (default), vip, chip48, schip\n"
+           "                     or xochip\n"
+           "  --threads <n>      worker threads (default all)\n"
+           "  --seconds <n>      stop after n seconds (default 60)\n"
+           "  --runs <n>         stop after n runs instead\n"
+           "  --seed <n>         seed the fuzzer itself\n"
+           "  --crashes <dir>    write a replayable movie per distinct crash\n",
+           program);
+}
+
+// One run: the RNG seed and the keypad state for every frame.
+struct FuzzInput {
+    uint32_t seed = 0;
+    std::vector<uint16_t> keys;
+};
+
+struct Options {
+    int frames = 120;
+    int instructionsPerFrame = 500;
+    double seconds = 60.0;
+    std::optional<uint64_t> runs;
+    std::optional<std::filesystem::path> crashDirectory;
+};
+
+bool isCrash(Chip8::Status status) {
+    return status == Chip8::Status::INVALID_INSTRUCTION ||
+           status == Chip8::Status::STACK_OVERFLOW ||
+           status == Chip8::Status::STACK_UNDERFLOW ||
+           status == Chip8::Status::MEMORY_OUT_OF_BOUNDS ||
+           status == Chip8::Status::ERROR;
+}
+
+const char *crashName(Chip8::Status status) {
+    switch (status) {
+    case Chip8::Status::INVALID_INSTRUCTION:
+        return "invalid-instruction";
+    case Chip8::Status::STACK_OVERFLOW:
+        return "stack-overflow";
+    case Chip8::Status::STACK_UNDERFLOW:
+        return "stack-underflow";
+    case Chip8::Status::MEMORY_OUT_OF_BOUNDS:
+        return "memory-out-of-bounds";
+    default:
+        return "error";
+    }
+}
+
+// State every worker shares. Runs never touch it; only inputs that found
+// new edges or crashes take the lock.
+class Campaign {
+  public:
+    Campaign(const Chip8 &golden, const Options &options, uint64_t romHash)
+        : golden(golden), options(options), romHash(romHash) {
+        corpus.push_back({0, std::vector<uint16_t>(options.frames, 0)});
+    }
+
+    void work(uint32_t workerSeed) {
+        Chip8Arena arena(golden, 1);
+        std::mt19937 rng(workerSeed);
+        Chip8::CoverageMap runEdges;
+        Chip8::CoverageMap knownEdges = {};
+        while (!stop.load(std::memory_order_relaxed)) {
+            FuzzInput input = pick(rng);
+            mutate(input, rng);
+
+            runEdges.fill(0);
+            Chip8 *emulator = arena.acquire(input.seed);
+            emulator->setCoverageMap(&runEdges);
+            auto status = Chip8::Status::OK;
+            int frame = 0;
+            for (; frame < options.frames && status == Chip8::Status::OK;
+                 frame++) {
+                emulator->setKeyState(input.keys[frame]);
+                status = emulator->runFrame(options.instructionsPerFrame);
+            }
+            const uint16_t pc = emulator->getState().pc;
+            arena.release(emulator);
+
+            if (isCrash(status)) {
+                reportCrash(input, status, pc, frame);
+            }
+            bool novel = false;
+            for (std::size_t i = 0; i < runEdges.size() && !novel; i++) {
+                novel = runEdges[i] & ~knownEdges[i];
+            }
+            if (novel) {
+                merge(input, runEdges, knownEdges);
+            }
+            const auto done = runs.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (options.runs && done >= *options.runs) {
+                stop = true;
+            }
+        }
+    }
+
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> runs = 0;
+
+    // corpus size, edges and distinct crashes
+    std::tuple<std::size_t, int, std::size_t> stats() {
+        std::lock_guard lock(mutex);
+        int edges = 0;
+        for (uint8_t byte : coverage) {
+            edges += std::popcount(byte);
+        }
+        return {corpus.size(), edges, crashes.size()};
+    }
+
+  private:
+    FuzzInput pick(std::mt19937 &rng) {
+        std::lock_guard lock(mutex);
+        return corpus[rng() % corpus.size()];
+    }
+
+    // a few stacked edits, mostly to key timing since that is what
+    // steers a ROM
+    void mutate(FuzzInput &input, std::mt19937 &rng) {
+        const int frames = options.frames;
+        const int edits = 1 + rng() % 4;
+        for (int edit = 0; edit < edits; edit++) {
+            const int start = rng() % frames;
+            const int length = std::min<int>(1 + rng() % 16, frames - start);
+            switch (rng() % 6) {
+            case 0:
+                input.keys[start] ^= 1 << (rng() % 16);
+                break;
+            case 1:
+                // hold one key
+                std::fill_n(&input.keys[start], length, 1 << (rng() % 16));
+                break;
+            case 2:
+                std::fill_n(&input.keys[start], length, 0);
+                break;
+            case 3:
+                std::fill_n(&input.keys[start], length,
+                            static_cast<uint16_t>(rng()));
+                break;
+            case 4: {
+                // splice in the same frames from another corpus entry
+                FuzzInput donor = pick(rng);
+                std::copy_n(&donor.keys[start], length, &input.keys[start]);
+                break;
+            }
+            default:
+                input.seed = rng();
+                break;
+            }
+        }
+    }
+
+    void merge(const FuzzInput &input, const Chip8::CoverageMap &runEdges,
+               Chip8::CoverageMap &knownEdges) {
+        std::lock_guard lock(mutex);
+        bool grew = false;
+        for (std::size_t i = 0; i < coverage.size(); i++) {
+            grew |= (runEdges[i] & ~coverage[i]) != 0;
+            coverage[i] |= runEdges[i];
+        }
+        // another worker may have found these edges first
+        if (grew) {
+            corpus.push_back(input);
+        }
+        knownEdges = coverage;
+    }
+
+    void reportCrash(const FuzzInput &input, Chip8::Status status,
+                     uint16_t pc, int frames) {
+        std::lock_guard lock(mutex);
+        if (!crashes.insert({static_cast<int>(status), pc}).second) {
+            return;
+        }
+        printf("crash: %s at 0x%03X in frame %d, seed %u\n",
+               crashName(status), pc, frames - 1, input.seed);
+        if (!options.crashDirectory) {
+            return;
+        }
+
+        // the headless runner replays it with --replay
+        Chip8Movie movie;
+        movie.seed = input.seed;
+        movie.quirks = golden.getQuirks();
+        movie.instructionsPerFrame = options.instructionsPerFrame;
+        movie.frames = frames;
+        movie.romHash = romHash;
+        for (int frame = 0; frame < frames; frame++) {
+            movie.record(frame, input.keys[frame]);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "%s-%03x.c8mv", crashName(status), pc);
+        const auto path = *options.crashDirectory / name;
+        const auto data = movie.serialize();
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        out.write(reinterpret_cast<const char *>(data.data()), data.size());
+        if (out.fail()) {
+            std::cerr << "Failed to write file:" << path << "\n";
+        }
+    }
+
+    const Chip8 &golden;
+    const Options &options;
+    const uint64_t romHash;
+
+    std::mutex mutex;
+    std::vector<FuzzInput> corpus;
+    Chip8::CoverageMap coverage = {};
+    // (status, PC) pairs already reported
+    std::set<std::pair<int, uint16_t>> crashes;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::filesystem::path romPath;
+    Options options;
+    int threads = 0;
+    std::optional<uint32_t> seed;
+    Chip8::Quirks quirks = Chip8::MODERN_QUIRKS;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--frames") {
+            options.frames = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--ipf") {
+            options.instructionsPerFrame = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--threads") {
+            threads = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--seconds") {
+            options.seconds = std::stod(argv[++i]);
+        } else if (i + 1 < argc && arg == "--runs") {
+            options.runs = std::stoull(argv[++i]);
+        } else if (i + 1 < argc && arg == "--seed") {
+            seed = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--crashes") {
+            options.crashDirectory = argv[++i];
+        } else if (i + 1 < argc && arg == "--quirks") {
+            auto preset = Chip8::findQuirks(argv[++i]);
+            if (!preset) {
+                std::cerr << "Unknown quirks:" << argv[i] << "\n";
+                return 1;
+            }
+            quirks = *preset;
+        } else if (!arg.starts_with("--") && romPath.empty()) {
+            romPath = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (romPath.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.frames <= 0 || options.instructionsPerFrame <= 0) {
+        std::cerr << "Frames and instructions per frame must be positive\n";
+        return 1;
+    }
+    if (options.crashDirectory) {
+        std::error_code error;
+        std::filesystem::create_directories(*options.crashDirectory, error);
+        if (error) {
+            std::cerr << "Failed to create directory:"
+                      << *options.crashDirectory << "\n";
+            return 1;
+        }
+    }
+
+    auto romCache = Chip8RomCache::open(romPath);
+    if (!romCache || romCache->roms().size() != 1) {
+        std::cerr << "Not a single ROM:" << romPath << "\n";
+        return 1;
+    }
+    const auto romImage = romCache->roms().front().image;
+
+    // every run starts as a copy of this, decode cache included
+    auto golden = std::make_unique<Chip8>(0);
+    golden->setQuirks(quirks);
+    if (golden->loadProgram(romImage) != Chip8::Status::OK) {
+        std::cerr << "ROM does not fit in memory:" << romPath << "\n";
+        return 1;
+    }
+    golden->precompile();
+
+    if (threads <= 0) {
+        threads =
+            std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    Campaign campaign(*golden, options, Chip8Movie::hashRom(romImage));
+    std::seed_seq seeds{seed.value_or(std::random_device{}())};
+    std::vector<uint32_t> workerSeeds(threads);
+    seeds.generate(workerSeeds.begin(), workerSeeds.end());
+
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&] {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    };
+    auto report = [&] {
+        auto [corpus, edges, crashes] = campaign.stats();
+        const auto runs = campaign.runs.load();
+        const double seconds = elapsed();
+        printf("%.0f s: %llu runs (%.0f/s), corpus %zu, edges %d, "
+               "crashes %zu\n",
+               seconds, static_cast<unsigned long long>(runs),
+               seconds > 0 ? runs / seconds : 0.0, corpus, edges, crashes);
+        fflush(stdout);
+        return crashes;
+    };
+    {
+        std::vector<std::jthread> workers;
+        for (int worker = 0; worker < threads; worker++) {
+            workers.emplace_back(
+                [&, worker] { campaign.work(workerSeeds[worker]); });
+        }
+        int nextReport = 1;
+        while (!campaign.stop) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            if (!options.runs && elapsed() >= options.seconds) {
+                campaign.stop = true;
+            } else if (elapsed() >= nextReport) {
+                report();
+                nextReport *= 2;
+            }
+        }
+    }
+    return report() ? 2 : 0;
+}
@@ -0,0 +1,577 @@
+#include "chip8.hpp"
+#include "chip8_capture.hpp"
+#include "chip8_disassembler.hpp"
+#include "chip8_farm.hpp"
+#include "chip8_movie.hpp"
+#include "chip8_rom_cache.hpp"
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+void printUsage(const char *program) {
+    printf("Usage: %s <program_path>... [options]\n"
+           "  ROMs may be files, directories of ROMs or --pack archives\n"
+           "  --frames <n>        run n 60 Hz frames (default 600)\n"
+           "  --instructions <n>  run n instructions instead of frames\n"
+           "  --ipf <n>           instructions per frame (default 500)\n"
+           "  --quiet             skip the display dump\n"
+           "  --quirks <name>     modern (default), vip, chip48, schip\n"
+           "                      or xochip\n"
+           "  --load-state <file> resume from a saved state\n"
+           "  --save-state <file> save the final state\n"
+           "  --seed <n>          seed the RNG for a reproducible run\n"
+           "  --record <file>     write an input movie of the run\n"
+           "  --replay <file>     replay an input movie as fast as possible\n"
+           "  --profile <file>    print an opcode profile and write folded\n"
+           "                      stacks (needs -DCHIP8_PROFILE=ON)\n"
+           "  --threads <n>       worker threads for several ROMs (default "
+           "all)\n"
+           "  --debug             read debugger commands from stdin, 'help'\n"
+           "                      lists them\n"
+           "  --pack <file>       write the ROMs to one archive and exit\n"
+           "  --capture <file>    record every frame's display losslessly\n",
+           program);
+}
+
+std::optional<std::vector<uint8_t>>
+readRom(const std::filesystem::path &romPath) {
+    if (!std::filesystem::exists(romPath) ||
+        !std::filesystem::is_regular_file(romPath)) {
+        std::cerr << "File does not exist or is not a regular file:" << romPath
+                  << "\n";
+        return std::nullopt;
+    }
+    std::ifstream rom(romPath, std::ios::in | std::ios::binary);
+    if (rom.fail()) {
+        std::cerr << "Failed to open file:" << romPath.c_str() << "\n";
+        return std::nullopt;
+    }
+
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(rom)),
+                                std::istreambuf_iterator<char>());
+}
+
+bool writeFile(const std::filesystem::path &path,
+               std::span<const uint8_t> data) {
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+    if (out.fail()) {
+        std::cerr << "Failed to write file:" << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Several ROMs run as frame-budgeted jobs on the farm, one line each.
+int runFarm(std::span<const Chip8RomCache::Rom> roms, long frames,
+            int instructionsPerFrame, const Chip8::Quirks &quirks,
+            int threads) {
+    std::vector<Chip8Farm::Job> jobs;
+    for (const auto &rom : roms) {
+        jobs.push_back({
+            .name = rom.name,
+            .rom = rom.image,
+            .inputs = {},
+            .seed = std::nullopt,
+            .quirks = quirks,
+            .frames = static_cast<int>(frames),
+            .instructionsPerFrame = instructionsPerFrame,
+        });
+    }
+
+    auto report = Chip8Farm(threads).run(jobs);
+    int failures = 0;
+    for (const auto &result : report.results) {
+        printf("%-40s status=%d frames=%d display=%016llx\n",
+               result.name.c_str(), static_cast<int>(result.status),
+               result.framesRun,
+               static_cast<unsigned long long>(result.displayHash));
+        failures += result.status != Chip8::Status::OK &&
+                    result.status != Chip8::Status::PROGRAM_EXITED;
+    }
+    printf("%zu ROMs on %d threads in %.3f s, %d failed\n",
+           report.results.size(), report.threads, report.seconds, failures);
+    return failures ? 2 : 0;
+}
+
+void dumpDisplay(const Chip8 &emulator) {
+    // XO-CHIP's second plane shows as 'o', both planes as '@'
+    auto display = emulator.getDisplayBuffer();
+    auto second = emulator.getQuirks().xoChip ? emulator.getDisplayBuffer(1)
+                                              : std::span<const uint8_t>();
+    for (int y = 0; y < emulator.getDisplayHeight(); y++) {
+        std::string line;
+        for (int x = 0; x < emulator.getDisplayWidth(); x++) {
+            int pixel = y * emulator.getDisplayWidth() + x;
+            auto bit = [&](std::span<const uint8_t> plane) {
+                return !plane.empty() && ((plane[pixel / BITS_PER_BYTE] >>
+                                           (7 - pixel % BITS_PER_BYTE)) &
+                                          1);
+            };
+            line += ".#o@"[bit(display) | bit(second) << 1];
+        }
+        printf("%s\n", line.c_str());
+    }
+}
+
+void printDebugHelp() {
+    printf("break <addr>                  stop before the instruction at addr\n"
+           "delete <addr>                 remove that breakpoint\n"
+           "watch <addr> [len] [r|w|rw]   stop before I/O to memory there\n"
+           "cond <V0-VF|I|DT|ST> <op> <n> stop when it becomes true; op is\n"
+           "                              == != < <= > >=\n"
+           "clear                         drop all of the above\n"
+           "step [n]                      run n instructions\n"
+           "continue [frames]             run frames until something stops\n"
+           "until <addr> [frames]         run frames until PC reaches addr\n"
+           "regs                          print the registers\n"
+           "mem <addr> [len]              hex dump memory\n"
+           "disasm <addr> [count]         disassemble from addr\n"
+           "quit\n");
+}
+
+std::optional<Chip8::Condition> parseCondition(const std::string &operand,
+                                               const std::string &comparison,
+                                               unsigned long value) {
+    using enum Chip8::Comparison;
+    Chip8::Condition condition;
+    condition.value = value;
+    if (operand.size() == 2 && (operand[0] == 'V' || operand[0] == 'v') &&
+        std::isxdigit(static_cast<unsigned char>(operand[1]))) {
+        condition.operand = Chip8::ConditionOperand::REGISTER;
+        condition.x = std::stoi(operand.substr(1), nullptr, 16);
+    } else if (operand == "I") {
+        condition.operand = Chip8::ConditionOperand::INDEX;
+    } else if (operand == "DT") {
+        condition.operand = Chip8::ConditionOperand::DELAY_TIMER;
+    } else if (operand == "ST") {
+        condition.operand = Chip8::ConditionOperand::SOUND_TIMER;
+    } else {
+        return std::nullopt;
+    }
+    static const std::pair<const char *, Chip8::Comparison> comparisons[] = {
+        {"==", EQUAL}, {"!=", NOT_EQUAL}, {"<", LESS},
+        {"<=", LESS_EQUAL}, {">", GREATER}, {">=", GREATER_EQUAL},
+    };
+    for (const auto &[name, value] : comparisons) {
+        if (comparison == name) {
+            condition.comparison = value;
+            return condition;
+        }
+    }
+    return std::nullopt;
+}
+
+void printStop(const Chip8 &emulator, Chip8::Status status) {
+    if (status != Chip8::Status::BREAKPOINT) {
+        printf("status %d pc=0x%03X\n", static_cast<int>(status),
+               emulator.getState().pc);
+        return;
+    }
+    const auto &event = emulator.getDebugEvent();
+    switch (event.kind) {
+    case Chip8::DebugEvent::Kind::BREAKPOINT:
+        printf("stopped breakpoint pc=0x%03X\n", event.pc);
+        break;
+    case Chip8::DebugEvent::Kind::WATCHPOINT:
+        printf("stopped watchpoint pc=0x%03X address=0x%03X\n", event.pc,
+               event.detail);
+        break;
+    case Chip8::DebugEvent::Kind::CONDITION:
+        printf("stopped condition %d pc=0x%03X\n", event.detail, event.pc);
+        break;
+    }
+}
+
+// One command per stdin line, one reply per command, so the runner can be
+// driven by a script or another program.
+int runDebugger(Chip8 &emulator, int instructionsPerFrame, long frames) {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream words(line);
+        std::string command;
+        words >> command;
+        std::vector<std::string> args;
+        for (std::string word; words >> word;) {
+            args.push_back(word);
+        }
+        auto number = [&](std::size_t index, unsigned long fallback) {
+            return index < args.size() ? std::stoul(args[index], nullptr, 0)
+                                       : fallback;
+        };
+        try {
+            if (command.empty()) {
+                continue;
+            } else if (command == "help") {
+                printDebugHelp();
+            } else if (command == "quit") {
+                break;
+            } else if (command == "break" && !args.empty()) {
+                emulator.addBreakpoint(number(0, 0));
+                printf("ok\n");
+            } else if (command == "delete" && !args.empty()) {
+                emulator.removeBreakpoint(number(0, 0));
+                printf("ok\n");
+            } else if (command == "watch" && !args.empty()) {
+                const std::string kind = args.size() > 2 ? args[2] : "rw";
+                auto watchKind = kind == "r"   ? Chip8::WatchKind::READ
+                                 : kind == "w" ? Chip8::WatchKind::WRITE
+                                               : Chip8::WatchKind::READ_WRITE;
+                emulator.addWatchpoint(number(0, 0), number(1, 1), watchKind);
+                printf("ok\n");
+            } else if (command == "cond" && args.size() == 3) {
+                auto condition = parseCondition(args[0], args[1], number(2, 0));
+                if (!condition || !emulator.addCondition(*condition)) {
+                    printf("error: bad or too many conditions\n");
+                } else {
+                    printf("ok\n");
+                }
+            } else if (command == "clear") {
+                emulator.clearDebugPoints();
+                printf("ok\n");
+            } else if (command == "step") {
+                auto status = Chip8::Status::OK;
+                for (unsigned long i = 0;
+                     i < number(0, 1) && status == Chip8::Status::OK; i++) {
+                    emulator.resume();
+                    status = emulator.step();
+                }
+                printStop(emulator, status);
+            } else if (command == "continue") {
+                emulator.resume();
+                auto status = Chip8::Status::OK;
+                for (unsigned long i = 0;
+                     i < number(0, frames) && status == Chip8::Status::OK;
+                     i++) {
+                    status = emulator.runFrame(instructionsPerFrame);
+                }
+                printStop(emulator, status);
+            } else if (command == "until" && !args.empty()) {
+                printStop(emulator,
+                          emulator.runUntil(number(0, 0), number(1, frames),
+                                            instructionsPerFrame));
+            } else if (command == "regs") {
+                printf("%s", emulator.getState().toString().c_str());
+            } else if (command == "mem" && !args.empty()) {
+                auto memory = emulator.getMemory();
+                const unsigned long address = number(0, 0);
+                const unsigned long end =
+                    std::min<unsigned long>(address + number(1, 16),
+                                            memory.size());
+                for (unsigned long at = address; at < end; at++) {
+                    printf("%02X%s", memory[at],
+                           at + 1 == end || (at - address) % 16 == 15 ? "\n"
+                                                                      : " ");
+                }
+                if (address >= end) {
+                    printf("\n");
+                }
+            } else if (command == "disasm" && !args.empty()) {
+                auto memory = emulator.getMemory();
+                unsigned long address = number(0, 0);
+                for (unsigned long i = 0;
+                     i < number(1, 8) && address + 1 < memory.size();
+                     i++, address += 2) {
+                    const uint16_t instruction =
+                        memory[address] << 8 | memory[address + 1];
+                    printf("0x%03lX  %04X  %s\n", address, instruction,
+                           Chip8Disassembler::disassemble(
+                               instruction, emulator.getQuirks())
+                               .c_str());
+                }
+            } else {
+                printf("error: unknown command, try help\n");
+            }
+        } catch (const std::logic_error &) {
+            // std::stoul on something that is not a number
+            printf("error: bad number\n");
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::vector<std::filesystem::path> romPaths;
+    long frames = 600;
+    long instructions = -1;
+    int instructionsPerFrame = 500;
+    int threads = 0;
+    bool quiet = false;
+    bool debug = false;
+    std::optional<std::filesystem::path> loadStatePath;
+    std::optional<std::filesystem::path> saveStatePath;
+    std::optional<uint32_t> seed;
+    std::optional<std::filesystem::path> recordPath;
+    std::optional<std::filesystem::path> replayPath;
+    std::optional<std::filesystem::path> profilePath;
+    std::optional<std::filesystem::path> packPath;
+    std::optional<std::filesystem::path> capturePath;
+    // unset means modern, or whatever a replayed movie was recorded with
+    std::optional<Chip8::Quirks> quirks;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--quiet") {
+            quiet = true;
+        } else if (arg == "--debug") {
+            debug = true;
+        } else if (i + 1 < argc && arg == "--frames") {
+            frames = std::stol(argv[++i]);
+        } else if (i + 1 < argc && arg == "--instructions") {
+            instructions = std::stol(argv[++i]);
+        } else if (i + 1 < argc && arg == "--ipf") {
+            instructionsPerFrame = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--threads") {
+            threads = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--load-state") {
+            loadStatePath = argv[++i];
+        } else if (i + 1 < argc && arg == "--save-state") {
+            saveStatePath = argv[++i];
+        } else if (i + 1 < argc && arg == "--quirks") {
+            auto preset = Chip8::findQuirks(argv[++i]);
+            if (!preset) {
+                std::cerr << "Unknown quirks:" << argv[i] << "\n";
+                return 1;
+            }
+            quirks = *preset;
+        } else if (i + 1 < argc && arg == "--seed") {
+            seed = std::stoul(argv[++i]);
+        } else if (i + 1 < argc && arg == "--record") {
+            recordPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--replay") {
+            replayPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--profile") {
+            profilePath = argv[++i];
+        } else if (i + 1 < argc && arg == "--pack") {
+            packPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--capture") {
+            capturePath = argv[++i];
+        } else if (!arg.starts_with("--")) {
+            romPaths.push_back(arg);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (romPaths.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (instructionsPerFrame <= 0) {
+        std::cerr << "Instructions per frame must be positive\n";
+        return 1;
+    }
+#ifndef CHIP8_PROFILE
+    if (profilePath) {
+        std::cerr << "Built without the profiler; configure with "
+                     "-DCHIP8_PROFILE=ON\n";
+        return 1;
+    }
+#endif
+    // every image stays mapped until exit, shared by however many jobs
+    std::vector<Chip8RomCache> romCaches;
+    std::vector<Chip8RomCache::Rom> roms;
+    for (const auto &romPath : romPaths) {
+        auto cache = Chip8RomCache::open(romPath);
+        if (!cache) {
+            std::cerr << "Not a readable ROM, directory or archive:" << romPath
+                      << "\n";
+            return 1;
+        }
+        roms.insert(roms.end(), cache->roms().begin(), cache->roms().end());
+        romCaches.push_back(std::move(*cache));
+    }
+    if (packPath) {
+        return writeFile(*packPath, Chip8RomCache::pack(roms)) ? 0 : 1;
+    }
+    if (roms.size() != 1) {
+        // these all describe a single run
+        const std::pair<bool, const char *> singleRunOptions[] = {
+            {instructions >= 0, "--instructions"},
+            {seed.has_value(), "--seed"},
+            {recordPath.has_value(), "--record"},
+            {replayPath.has_value(), "--replay"},
+            {capturePath.has_value(), "--capture"},
+            {loadStatePath.has_value(), "--load-state"},
+            {saveStatePath.has_value(), "--save-state"},
+            {profilePath.has_value(), "--profile"},
+            {debug, "--debug"},
+        };
+        for (const auto &[given, option] : singleRunOptions) {
+            if (given) {
+                std::cerr << option << " needs a single ROM, not "
+                          << roms.size() << "\n";
+                return 1;
+            }
+        }
+        return runFarm(roms, frames, instructionsPerFrame,
+                       quirks.value_or(Chip8::MODERN_QUIRKS), threads);
+    }
+
+    const auto &romName = roms.front().name;
+    const auto romImage = roms.front().image;
+
+    Chip8Movie movie;
+    if (replayPath) {
+        auto movieBuffer = readRom(*replayPath);
+        auto loaded = movieBuffer ? Chip8Movie::deserialize(*movieBuffer)
+                                  : std::nullopt;
+        if (!loaded) {
+            std::cerr << "Not a usable input movie:" << *replayPath << "\n";
+            return 1;
+        }
+        movie = std::move(*loaded);
+        if (movie.romHash != Chip8Movie::hashRom(romImage)) {
+            std::cerr << "Movie was recorded with a different ROM\n";
+            return 1;
+        }
+        if (quirks && *quirks != movie.quirks) {
+            std::cerr << "Movie was recorded with different quirks\n";
+            return 1;
+        }
+        // the movie decides everything that affects the outcome
+        seed = movie.seed;
+        quirks = movie.quirks;
+        instructionsPerFrame = movie.instructionsPerFrame;
+        frames = movie.frames;
+        instructions = -1;
+    } else if (recordPath) {
+        if (instructions >= 0) {
+            std::cerr << "Movies cover whole frames; use --frames\n";
+            return 1;
+        }
+        movie.seed = seed.value_or(std::random_device{}());
+        seed = movie.seed;
+        movie.quirks = quirks.value_or(Chip8::MODERN_QUIRKS);
+        movie.instructionsPerFrame = instructionsPerFrame;
+        movie.romHash = Chip8Movie::hashRom(romImage);
+    }
+
+    Chip8 emulator(seed.value_or(std::random_device{}()));
+    emulator.setQuirks(quirks.value_or(Chip8::MODERN_QUIRKS));
+    if (emulator.loadProgram(romImage) != Chip8::Status::OK) {
+        std::cerr << "ROM does not fit in memory:" << romName << "\n";
+        return 1;
+    }
+
+    if (loadStatePath) {
+        auto state = readRom(*loadStatePath);
+        if (!state || emulator.deserializeState(*state) != Chip8::Status::OK) {
+            std::cerr << "Not a usable save state:" << *loadStatePath << "\n";
+            return 1;
+        }
+    }
+    emulator.precompile();
+    if (debug) {
+        return runDebugger(emulator, instructionsPerFrame, frames);
+    }
+
+    // an instruction budget runs whole frames and then the remainder
+    long remainder = 0;
+    if (instructions >= 0) {
+        frames = instructions / instructionsPerFrame;
+        remainder = instructions % instructionsPerFrame;
+    }
+
+    // offline, so frames are encoded inline and none can be dropped
+    std::vector<uint8_t> capture;
+    std::optional<Chip8CaptureEncoder> captureEncoder;
+    if (capturePath) {
+        captureEncoder.emplace(capture);
+    }
+
+    auto status = Chip8::Status::OK;
+    // frames that stop early on an error or a display-wait draw run
+    // fewer than their budget, so count what the core actually retired
+    const uint64_t startCycles = emulator.getCycles();
+    auto start = std::chrono::steady_clock::now();
+    Chip8InputPlayback playback(movie.inputs);
+    // movies recorded against an emulated clock carry the fractional
+    // budget exactly like the SDL platform did
+    int cycleCarry = 0;
+    long framesRun = 0;
+    for (; framesRun < frames && status == Chip8::Status::OK; framesRun++) {
+        int budget = instructionsPerFrame;
+        if (movie.cpuHz > 0) {
+            cycleCarry += movie.cpuHz;
+            budget = cycleCarry / Chip8::TARGET_FPS;
+            cycleCarry %= Chip8::TARGET_FPS;
+        }
+        playback.apply(emulator, framesRun);
+        status = emulator.runFrame(budget);
+        if (captureEncoder) {
+            captureEncoder->addFrame(emulator.getDisplayBuffer(),
+                                     emulator.getDisplayWidth(),
+                                     emulator.getDisplayHeight(), capture);
+        }
+    }
+    if (status == Chip8::Status::OK && remainder > 0) {
+        status = emulator.runCycles(remainder);
+    }
+    const long executed = static_cast<long>(emulator.getCycles() - startCycles);
+    auto elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+    if (!quiet) {
+        dumpDisplay(emulator);
+    }
+    if (saveStatePath) {
+        std::vector<uint8_t> state(Chip8::SERIALIZED_STATE_SIZE);
+        emulator.serializeState(state);
+        if (!writeFile(*saveStatePath, state)) {
+            return 1;
+        }
+    }
+#ifdef CHIP8_PROFILE
+    if (profilePath) {
+        const auto &profiler = emulator.getProfiler();
+        printf("%s", profiler.report().c_str());
+        auto folded = profiler.foldedStacks();
+        if (!writeFile(*profilePath,
+                       std::span(reinterpret_cast<const uint8_t *>(
+                                     folded.data()),
+                                 folded.size()))) {
+            return 1;
+        }
+    }
+#endif
+    if (captureEncoder) {
+        captureEncoder->finish(capture);
+        if (!writeFile(*capturePath, capture)) {
+            return 1;
+        }
+    }
+    if (recordPath) {
+        movie.frames = framesRun;
+        if (!writeFile(*recordPath, movie.serialize())) {
+            return 1;
+        }
+    }
+    printf("%s", emulator.getState().toString().c_str());
+    printf("Status: %d\n", static_cast<int>(status));
+    printf("Display: %016llx\n",
+           static_cast<unsigned long long>(
+               Chip8Farm::hashDisplay(emulator)));
+    printf("Instructions: %ld in %.3f s (%.0f per second)\n", executed,
+           elapsed, elapsed > 0 ? executed / elapsed : 0.0);
+    return status == Chip8::Status::OK ||
+                   status == Chip8::Status::PROGRAM_EXITED
+               ? 0
+               : 2;
+}
@@ -1,2 +1,16 @@
 #pragma once
+#include <cstdint>
+#include <span>
+
 constexpr int BITS_PER_BYTE = 8;
+
+// 64-bit FNV-1a, for fingerprints of ROMs and displays
+// pass the previous result as `hash` to continue over several spans
+constexpr uint64_t fnv1a(std::span<const uint8_t> bytes,
+                         uint64_t hash = 0xcbf29ce484222325) {
+    for (uint8_t byte : bytes) {
+        hash ^= byte;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
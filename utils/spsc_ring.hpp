@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+// Bounded single-producer single-consumer queue. push() is only called from
+// one thread and pop() from one other; neither ever blocks or allocates.
+template <typename T, std::size_t Capacity> class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+  public:
+    // false if the ring is full and the value was dropped
+    bool push(const T &value) {
+        const std::size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        slots[tail & (Capacity - 1)] = value;
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // false if the ring is empty
+    bool pop(T &value) {
+        const std::size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = slots[head & (Capacity - 1)];
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+  private:
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    std::array<T, Capacity> slots = {};
+    // each index lives on its own line so the two threads do not share one
+    alignas(CACHE_LINE) std::atomic<std::size_t> head = 0;
+    alignas(CACHE_LINE) std::atomic<std::size_t> tail = 0;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of whole values from one producer thread to one
+// consumer thread. The producer fills back() and publishes it; the consumer
+// picks up the newest published value, skipping any it was too slow to see.
+// Neither side ever waits for the other.
+template <typename T> class TripleBuffer {
+  public:
+    // producer side
+    T &back() { return slots[backIndex]; }
+    void publish() {
+        backIndex = middle.exchange(backIndex | FRESH,
+                                    std::memory_order_acq_rel) &
+                    INDEX_MASK;
+    }
+
+    // consumer side; true if a newer value replaced front()
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        frontIndex =
+            middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    const T &front() const { return slots[frontIndex]; }
+
+  private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    // set on the middle index while it holds a value the consumer has not
+    // taken yet
+    static constexpr uint8_t FRESH = 0x4;
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    std::array<T, 3> slots = {};
+    alignas(CACHE_LINE) uint8_t backIndex = 0;
+    alignas(CACHE_LINE) std::atomic<uint8_t> middle = 1;
+    alignas(CACHE_LINE) uint8_t frontIndex = 2;
+};